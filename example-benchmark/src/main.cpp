@@ -0,0 +1,30 @@
+#include "testApp.h"
+#include "ofAppGlutWindow.h"
+
+//--------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	// --headless: update and dispatch only, through a NullBackend without a window
+	if (argc > 1 && string(argv[1]) == "--headless")
+	{
+		ofResetElapsedTimeCounter();
+
+		Benchmark benchmark(true);
+		if (!benchmark.checkDefaultPicking()) return 1;
+		if (!benchmark.checkSteadyStateAllocations()) return 1;
+
+		benchmark.addDefaultCases();
+		benchmark.runAll();
+
+		string path = argc > 2 ? string(argv[2]) : ofToDataPath("benchmark.json");
+		benchmark.save(path);
+
+		cout << benchmark.toJSON();
+		return 0;
+	}
+
+	ofAppGlutWindow window; // create a window
+	// set width, height, mode (OF_WINDOW or OF_FULLSCREEN)
+	ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+	ofRunApp(new testApp()); // start the app
+}
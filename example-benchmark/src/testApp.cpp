@@ -0,0 +1,802 @@
+#include "testApp.h"
+
+using namespace ofxInteractivePrimitives;
+
+Benchmark *benchmark = NULL;
+
+// counts every heap allocation while enabled, see checkSteadyStateAllocations
+
+static bool count_allocations = false;
+static unsigned int num_allocations = 0;
+
+// the replaced operators have to match the declarations in <new>
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define NO_THROW noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define NO_THROW throw()
+#endif
+
+void* operator new(size_t size) THROW_BAD_ALLOC
+{
+	if (count_allocations) num_allocations++;
+
+	void *p = malloc(size ? size : 1);
+	if (p == NULL) throw std::bad_alloc();
+
+	return p;
+}
+
+void* operator new[](size_t size) THROW_BAD_ALLOC
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) NO_THROW
+{
+	free(p);
+}
+
+void operator delete[](void *p) NO_THROW
+{
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, size_t) NO_THROW
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) NO_THROW
+{
+	free(p);
+}
+#endif
+
+//
+
+struct BenchmarkPatcher : public AbstructWrapper<BenchmarkPatcher>
+{
+	static int getNumInput() { return 1; }
+	static int getNumOutput() { return 1; }
+
+	static TypeID getInputType(int index) { return Type2Int<float>(); }
+	static TypeID getOutputType(int index) { return Type2Int<float>(); }
+
+	static void layout(Patcher *patcher, Context *context)
+	{
+		patcher->setText("patcher");
+	}
+
+	static void execute(Patcher *patcher, Context *context, const vector<MessageRef>& input, vector<MessageRef>& output)
+	{
+		float v = input[0] ? input[0]->as<float>()->get() : 0;
+		Message<float>::assign(output[0], v + 1);
+	}
+};
+
+// connects patchers directly, without patching by mouse
+struct ChainPatcher : public BenchmarkPatcher::Patcher
+{
+	ChainPatcher(Node &parent) : BenchmarkPatcher::Patcher(parent) {}
+
+	void connectTo(ChainPatcher *o)
+	{
+		createPatchCord(&getOutputPort(0), &o->getInputPort(0));
+	}
+
+	void disconnect()
+	{
+		disposePatchCords();
+	}
+};
+
+static const char* layoutName(Benchmark::Layout layout)
+{
+	switch (layout)
+	{
+		case Benchmark::FLAT: return "flat";
+		case Benchmark::DEEP: return "deep";
+		case Benchmark::WIDE: return "wide";
+	}
+
+	return "unknown";
+}
+
+static const char* typeName(Benchmark::NodeType type)
+{
+	switch (type)
+	{
+		case Benchmark::MARKER: return "marker";
+		case Benchmark::STRING_BOX: return "stringbox";
+		case Benchmark::PATCHER: return "patcher";
+	}
+
+	return "unknown";
+}
+
+static float percentile(const vector<float>& sorted, float q)
+{
+	if (sorted.empty()) return 0;
+
+	size_t i = q * sorted.size();
+	if (i >= sorted.size()) i = sorted.size() - 1;
+
+	return sorted[i];
+}
+
+static void writeSeries(ostream &os, const char *name, const vector<float>& samples)
+{
+	vector<float> sorted = samples;
+	sort(sorted.begin(), sorted.end());
+
+	float sum = 0;
+	for (size_t i = 0; i < sorted.size(); i++) sum += sorted[i];
+
+	os << "\"" << name << "\": {";
+	os << "\"count\": " << sorted.size();
+	os << ", \"mean\": " << (sorted.empty() ? 0 : sum / sorted.size());
+	os << ", \"p50\": " << percentile(sorted, 0.5);
+	os << ", \"p90\": " << percentile(sorted, 0.9);
+	os << ", \"p99\": " << percentile(sorted, 0.99);
+	os << ", \"max\": " << (sorted.empty() ? 0 : sorted.back());
+	os << "}";
+}
+
+// Benchmark
+
+string Benchmark::Case::getName() const
+{
+	stringstream ss;
+	ss << typeName(type) << "_" << layoutName(layout) << "_" << num_nodes;
+	ss << (picking_mode == RootNode::PICKING_CPU ? "_cpu" : "_glselect");
+	if (move_root) ss << "_moving";
+	if (transform_store) ss << "_store";
+	if (batching) ss << "_batched";
+	if (cached) ss << "_cached";
+	return ss.str();
+}
+
+Benchmark::Benchmark(bool headless) : headless(headless), current_case(0), current_frame(0), root(NULL)
+{
+}
+
+Benchmark::~Benchmark()
+{
+	destroyScene();
+}
+
+void Benchmark::addDefaultCases()
+{
+	const int sizes[] = { 1000, 10000, 100000 };
+
+	Case c;
+	c.picking_mode = RootNode::PICKING_CPU;
+	c.transform_store = false;
+	c.move_root = false;
+	c.batching = false;
+	c.cached = false;
+
+	for (int s = 0; s < 3; s++)
+	{
+		c.num_nodes = sizes[s];
+
+		for (int l = FLAT; l <= WIDE; l++)
+		{
+			c.layout = (Layout)l;
+
+			for (int t = MARKER; t <= PATCHER; t++)
+			{
+				c.type = (NodeType)t;
+				addCase(c);
+			}
+		}
+	}
+
+	// per node transforms against the transform store, everything dirty every frame
+	c.type = MARKER;
+	c.move_root = true;
+
+	for (int s = 1; s < 3; s++)
+	{
+		c.num_nodes = sizes[s];
+
+		for (int l = FLAT; l <= DEEP; l++)
+		{
+			c.layout = (Layout)l;
+
+			c.transform_store = false;
+			addCase(c);
+
+			c.transform_store = true;
+			addCase(c);
+		}
+	}
+
+	// immediate against batched drawing of the built-in widgets
+	c.layout = FLAT;
+	c.move_root = false;
+	c.transform_store = false;
+
+	for (int t = STRING_BOX; t <= PATCHER; t++)
+	{
+		c.type = (NodeType)t;
+		c.num_nodes = sizes[1];
+
+		if (!headless)
+		{
+			c.batching = false;
+			addCase(c);
+		}
+
+		c.batching = true;
+		addCase(c);
+	}
+
+	c.batching = false;
+
+	// GL_SELECT and render caches need a GL context
+	if (!headless)
+	{
+		c.type = STRING_BOX;
+		c.layout = WIDE;
+		c.num_nodes = sizes[1];
+
+		c.cached = false;
+		addCase(c);
+
+		c.cached = true;
+		addCase(c);
+
+		c.cached = false;
+
+		c.type = STRING_BOX;
+		c.layout = FLAT;
+		c.picking_mode = RootNode::PICKING_GL_SELECT;
+		c.transform_store = false;
+		c.move_root = false;
+
+		for (int s = 0; s < 2; s++)
+		{
+			c.num_nodes = sizes[s];
+			addCase(c);
+		}
+	}
+}
+
+void Benchmark::update()
+{
+	if (isFinished()) return;
+
+	if (current_frame == 0) beginCase();
+
+	Result &r = results.back();
+	bool measure = current_frame >= WARMUP_FRAMES;
+
+	if (r.config.move_root)
+		root->setPosition(sin(current_frame * 0.1) * 10, 0, 0);
+
+	unsigned long long t = ofGetElapsedTimeMicros();
+	root->update();
+	if (measure) r.update_us.push_back(ofGetElapsedTimeMicros() - t);
+
+	replayInput(r, measure);
+
+	if (headless)
+	{
+		// a NullBackend draw only builds the batch
+		if (r.config.batching) measureDraw(r, measure);
+
+		advance();
+	}
+}
+
+void Benchmark::draw()
+{
+	if (isFinished() || root == NULL) return;
+
+	measureDraw(results.back(), current_frame >= WARMUP_FRAMES);
+
+	advance();
+}
+
+void Benchmark::measureDraw(Result &r, bool measure)
+{
+	unsigned long long t = ofGetElapsedTimeMicros();
+	root->draw();
+	if (measure) r.draw_us.push_back(ofGetElapsedTimeMicros() - t);
+
+	r.culled_nodes = root->getNumCulledNodes();
+	r.draw_calls = root->getNumDrawCalls();
+	r.cache_renders = root->getNumCacheRenders();
+	r.state_changes = root->getNumStateChanges();
+	r.redundant_state_changes = root->getNumRedundantStateChanges();
+}
+
+void Benchmark::runAll()
+{
+	assert(headless);
+
+	while (!isFinished())
+		update();
+}
+
+bool Benchmark::checkDefaultPicking()
+{
+	assert(headless);
+
+	RootNode root;
+	root.disableAllEvent();
+	root.setBackend(new NullBackend(1024, 768));
+
+	Marker *o = new Marker(root);
+	o->setPosition(512, 384, 0);
+
+	root.update();
+	root.notifyMouseMoved(512, 384);
+
+	bool picked = o->isHover();
+
+	o->dispose();
+	delete o;
+
+	if (!picked) ofLogError("Benchmark") << "default picking mode missed the node under the mouse";
+
+	return picked;
+}
+
+bool Benchmark::checkSteadyStateAllocations()
+{
+	assert(headless);
+
+	Case c;
+	c.num_nodes = 1000;
+	c.layout = FLAT;
+	c.type = MARKER;
+	c.picking_mode = RootNode::PICKING_CPU;
+	c.transform_store = false;
+	c.move_root = false;
+	c.batching = false;
+	c.cached = false;
+
+	random_state = 1;
+	buildScene(c);
+
+	// the first burst grows the reused buffers, the second replays the same input
+	root->update();
+	replayBurst();
+
+	root->update();
+
+	num_allocations = 0;
+	count_allocations = true;
+
+	replayBurst();
+
+	count_allocations = false;
+
+	unsigned int dispatch_allocations = num_allocations;
+
+	// a chain of patchers, outputs and inputs keep their messages once they hold one
+	vector<ChainPatcher*> chain;
+
+	for (int i = 0; i < CHAIN_LENGTH; i++)
+	{
+		chain.push_back(new ChainPatcher(*root));
+		if (i > 0) chain[i - 1]->connectTo(chain[i]);
+	}
+
+	chain[0]->execute();
+
+	num_allocations = 0;
+	count_allocations = true;
+
+	for (int i = 0; i < 100; i++)
+		chain[0]->execute();
+
+	count_allocations = false;
+
+	unsigned int patcher_allocations = num_allocations;
+
+	for (size_t i = 0; i < chain.size(); i++)
+		chain[i]->disconnect();
+
+	DelayedDeletable::deleteQueue();
+
+	for (int i = chain.size() - 1; i >= 0; i--)
+		delete chain[i];
+
+	destroyScene();
+
+	if (dispatch_allocations > 0)
+		ofLogError("Benchmark") << dispatch_allocations << " allocations in steady state mouse dispatch";
+
+	if (patcher_allocations > 0)
+		ofLogError("Benchmark") << patcher_allocations << " allocations in steady state patcher evaluation";
+
+	return dispatch_allocations == 0 && patcher_allocations == 0;
+}
+
+void Benchmark::advance()
+{
+	current_frame++;
+
+	if (current_frame >= WARMUP_FRAMES + MEASURE_FRAMES)
+		endCase();
+}
+
+void Benchmark::beginCase()
+{
+	const Case &c = cases[current_case];
+
+	results.push_back(Result());
+	Result &r = results.back();
+	r.config = c;
+	r.culled_nodes = 0;
+	r.draw_calls = 0;
+	r.cache_renders = 0;
+	r.state_changes = r.redundant_state_changes = 0;
+
+	random_state = 1;
+	dragging = false;
+	drag_frames = 0;
+	mouse_x = mouse_y = 0;
+
+	unsigned long long t = ofGetElapsedTimeMicros();
+	buildScene(c);
+	r.setup_ms = (ofGetElapsedTimeMicros() - t) / 1000.0;
+
+	r.update_us.reserve(MEASURE_FRAMES);
+	r.draw_us.reserve(MEASURE_FRAMES);
+}
+
+void Benchmark::endCase()
+{
+	Result &r = results.back();
+
+	unsigned long long t = ofGetElapsedTimeMicros();
+	destroyScene();
+	r.teardown_ms = (ofGetElapsedTimeMicros() - t) / 1000.0;
+
+	ofLogNotice("Benchmark") << r.config.getName() << " done";
+
+	current_case++;
+	current_frame = 0;
+}
+
+Node* Benchmark::createNode(NodeType type, Node &parent)
+{
+	switch (type)
+	{
+		case MARKER:
+		{
+			Marker *o = new Marker(parent);
+			o->setText("marker");
+			return o;
+		}
+
+		case STRING_BOX:
+		{
+			StringBox *o = new StringBox(parent);
+			o->setText("stringbox");
+			return o;
+		}
+
+		case PATCHER:
+			return new BenchmarkPatcher::Patcher(parent);
+	}
+
+	return NULL;
+}
+
+void Benchmark::buildScene(const Case& c)
+{
+	root = new RootNode;
+	root->disableAllEvent();
+
+	if (headless)
+		root->setBackend(new NullBackend(1024, 768));
+
+	root->setPickingMode(c.picking_mode);
+	root->setTransformStoreEnabled(c.transform_store);
+	root->setBatching(c.batching);
+
+	nodes.reserve(c.num_nodes);
+
+	Node *parent = root;
+
+	for (int i = 0; i < c.num_nodes; i++)
+	{
+		Node *o = NULL;
+
+		if (c.layout == FLAT)
+		{
+			o = createNode(c.type, *root);
+			o->setPosition(random(0, 1024), random(0, 768), 0);
+		}
+		else if (c.layout == DEEP)
+		{
+			if (i % CHAIN_LENGTH == 0)
+			{
+				o = createNode(c.type, *root);
+				o->setPosition(random(0, 1024), random(0, 768), 0);
+			}
+			else
+			{
+				o = createNode(c.type, *parent);
+				o->setPosition(random(-4, 4), random(-4, 4), 0);
+			}
+
+			parent = o;
+		}
+		else
+		{
+			if (i < NUM_GROUPS)
+			{
+				o = createNode(c.type, *root);
+				o->setPosition(random(200, 824), random(200, 568), 0);
+				o->setCached(c.cached);
+			}
+			else
+			{
+				o = createNode(c.type, *nodes[i % NUM_GROUPS]);
+				o->setPosition(random(-200, 200), random(-200, 200), 0);
+			}
+		}
+
+		nodes.push_back(o);
+	}
+}
+
+void Benchmark::destroyScene()
+{
+	// children before their parents
+	for (int i = nodes.size() - 1; i >= 0; i--)
+	{
+		Node *o = nodes[i];
+
+		// patchers dispose themselves in the destructor
+		if (dynamic_cast<BasePatcher*>(o) == NULL) o->dispose();
+
+		delete o;
+	}
+
+	nodes.clear();
+
+	delete root;
+	root = NULL;
+}
+
+void Benchmark::replayInput(Result &r, bool measure)
+{
+	unsigned long long t;
+
+	if (!dragging)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			mouse_x = random(0, 1024);
+			mouse_y = random(0, 768);
+
+			t = ofGetElapsedTimeMicros();
+			root->notifyMouseMoved(mouse_x, mouse_y);
+			if (measure) r.moved_us.push_back(ofGetElapsedTimeMicros() - t);
+		}
+
+		if (current_frame % 10 == 0)
+		{
+			t = ofGetElapsedTimeMicros();
+			root->notifyMousePressed(mouse_x, mouse_y, 0);
+			if (measure) r.pressed_us.push_back(ofGetElapsedTimeMicros() - t);
+
+			dragging = true;
+			drag_frames = 0;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			mouse_x += random(-3, 3);
+			mouse_y += random(-3, 3);
+
+			t = ofGetElapsedTimeMicros();
+			root->notifyMouseDragged(mouse_x, mouse_y, 0);
+			if (measure) r.dragged_us.push_back(ofGetElapsedTimeMicros() - t);
+		}
+
+		if (++drag_frames == 5)
+		{
+			t = ofGetElapsedTimeMicros();
+			root->notifyMouseReleased(mouse_x, mouse_y, 0);
+			if (measure) r.released_us.push_back(ofGetElapsedTimeMicros() - t);
+
+			dragging = false;
+		}
+	}
+}
+
+void Benchmark::replayBurst()
+{
+	// the same positions on every call, nothing is recorded
+	unsigned int state = random_state;
+	random_state = 1;
+
+	for (int i = 0; i < 100; i++)
+	{
+		float x = random(0, 1024);
+		float y = random(0, 768);
+
+		root->notifyMouseMoved(x, y);
+
+		if (i % 10 == 0)
+		{
+			root->notifyMousePressed(x, y, 0);
+			root->notifyMouseReleased(x, y, 0);
+		}
+	}
+
+	random_state = state;
+}
+
+float Benchmark::random(float min, float max)
+{
+	// fixed LCG so that every run replays the same scene and input
+	random_state = random_state * 1664525 + 1013904223;
+	return min + (max - min) * ((random_state >> 8) / 16777216.0);
+}
+
+string Benchmark::toJSON() const
+{
+	stringstream os;
+
+	os << "{\n\"headless\": " << (headless ? "true" : "false") << ",\n";
+	os << "\"cases\": [\n";
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result &r = results[i];
+		const Case &c = r.config;
+
+		os << "{";
+		os << "\"name\": \"" << c.getName() << "\"";
+		os << ", \"nodes\": " << c.num_nodes;
+		os << ", \"layout\": \"" << layoutName(c.layout) << "\"";
+		os << ", \"type\": \"" << typeName(c.type) << "\"";
+		os << ", \"picking\": \"" << (c.picking_mode == RootNode::PICKING_CPU ? "cpu" : "glselect") << "\"";
+		os << ", \"transform_store\": " << (c.transform_store ? "true" : "false");
+		os << ", \"move_root\": " << (c.move_root ? "true" : "false");
+		os << ", \"setup_ms\": " << r.setup_ms;
+		os << ", \"teardown_ms\": " << r.teardown_ms;
+		os << ", \"batching\": " << (c.batching ? "true" : "false");
+		os << ", \"culled_nodes\": " << r.culled_nodes;
+		os << ", \"draw_calls\": " << r.draw_calls;
+		os << ", \"cached\": " << (c.cached ? "true" : "false");
+		os << ", \"cache_renders\": " << r.cache_renders;
+		os << ", \"state_changes\": " << r.state_changes;
+		os << ", \"redundant_state_changes\": " << r.redundant_state_changes;
+		os << ",\n  ";
+
+		writeSeries(os, "update_us", r.update_us);
+		os << ",\n  ";
+		writeSeries(os, "draw_us", r.draw_us);
+		os << ",\n  ";
+		writeSeries(os, "mouse_moved_us", r.moved_us);
+		os << ",\n  ";
+		writeSeries(os, "mouse_pressed_us", r.pressed_us);
+		os << ",\n  ";
+		writeSeries(os, "mouse_dragged_us", r.dragged_us);
+		os << ",\n  ";
+		writeSeries(os, "mouse_released_us", r.released_us);
+
+		os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	os << "]\n}\n";
+
+	return os.str();
+}
+
+void Benchmark::save(const string& path) const
+{
+	ofstream ofs(path.c_str());
+	ofs << toJSON();
+}
+
+//--------------------------------------------------------------
+void testApp::setup()
+{
+	ofSetFrameRate(0);
+	ofSetVerticalSync(false);
+	ofBackground(0);
+
+	benchmark = new Benchmark(false);
+	benchmark->addDefaultCases();
+}
+
+//--------------------------------------------------------------
+void testApp::update()
+{
+	ofxInteractivePrimitives::DelayedDeletable::deleteQueue();
+
+	benchmark->update();
+
+	if (benchmark->isFinished())
+	{
+		benchmark->save(ofToDataPath("benchmark.json"));
+		ofExit();
+	}
+}
+
+//--------------------------------------------------------------
+void testApp::draw()
+{
+	ofEnableAlphaBlending();
+
+	ofSetColor(255);
+
+	benchmark->draw();
+}
+
+//--------------------------------------------------------------
+void testApp::exit()
+{
+	delete benchmark;
+	benchmark = NULL;
+}
+
+//--------------------------------------------------------------
+void testApp::keyPressed(int key)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::keyReleased(int key)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseMoved(int x, int y)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseDragged(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mousePressed(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::mouseReleased(int x, int y, int button)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::windowResized(int w, int h)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::gotMessage(ofMessage msg)
+{
+
+}
+
+//--------------------------------------------------------------
+void testApp::dragEvent(ofDragInfo dragInfo)
+{
+
+}
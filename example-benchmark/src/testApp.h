@@ -0,0 +1,147 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxInteractivePrimitives.h"
+
+// synthetic scenes for measuring update, draw and event dispatch latency.
+// every case builds a fresh RootNode, replays the same scripted mouse
+// stream and records one sample per frame and per event in microseconds.
+
+class Benchmark
+{
+public:
+
+	enum Layout
+	{
+		FLAT,	// every node is a child of the root
+		DEEP,	// chains of CHAIN_LENGTH nodes
+		WIDE	// NUM_GROUPS parents with many children each
+	};
+
+	enum NodeType
+	{
+		MARKER,
+		STRING_BOX,
+		PATCHER
+	};
+
+	struct Case
+	{
+		int num_nodes;
+		Layout layout;
+		NodeType type;
+		ofxInteractivePrimitives::RootNode::PickingMode picking_mode;
+		bool transform_store;
+
+		// move the root every frame so that every global transform is dirty
+		bool move_root;
+
+		// batched drawing, also measured headless
+		bool batching;
+
+		// WIDE groups rendered through a render cache
+		bool cached;
+
+		string getName() const;
+	};
+
+	struct Result
+	{
+		Case config;
+		float setup_ms, teardown_ms;
+		unsigned int culled_nodes, draw_calls, cache_renders;
+		unsigned int state_changes, redundant_state_changes;
+
+		vector<float> update_us, draw_us;
+		vector<float> moved_us, pressed_us, dragged_us, released_us;
+	};
+
+	Benchmark(bool headless);
+	~Benchmark();
+
+	// full matrix of sizes, layouts and node types, plus the transform
+	// store comparison and a few GL_SELECT cases when drawing
+	void addDefaultCases();
+	void addCase(const Case& c) { cases.push_back(c); }
+
+	// one frame of the current case, call update then draw
+	void update();
+	void draw();
+
+	bool isFinished() const { return current_case >= (int)cases.size(); }
+
+	// headless only, runs every case to completion
+	void runAll();
+
+	// headless only, a node under the mouse has to be picked with the
+	// default picking mode, which falls back to the CPU without GL
+	bool checkDefaultPicking();
+
+	// headless only, mouse dispatch and a chain of patchers must not allocate
+	// once the reused buffers have grown, counted by the global operator new
+	// of the app
+	bool checkSteadyStateAllocations();
+
+	string toJSON() const;
+	void save(const string& path) const;
+
+protected:
+
+	enum
+	{
+		WARMUP_FRAMES = 10,
+		MEASURE_FRAMES = 60,
+		CHAIN_LENGTH = 100,
+		NUM_GROUPS = 10
+	};
+
+	bool headless;
+
+	vector<Case> cases;
+	vector<Result> results;
+
+	int current_case, current_frame;
+
+	ofxInteractivePrimitives::RootNode *root;
+	vector<ofxInteractivePrimitives::Node*> nodes;
+
+	// scripted input, deterministic per case
+	unsigned int random_state;
+	bool dragging;
+	int drag_frames;
+	float mouse_x, mouse_y;
+
+	void advance();
+	void beginCase();
+	void endCase();
+
+	ofxInteractivePrimitives::Node* createNode(NodeType type, ofxInteractivePrimitives::Node &parent);
+	void buildScene(const Case& c);
+	void destroyScene();
+
+	void replayInput(Result &r, bool measure);
+	void replayBurst();
+	void measureDraw(Result &r, bool measure);
+
+	float random(float min, float max);
+};
+
+class testApp : public ofBaseApp
+{
+public:
+	void setup();
+	void update();
+	void draw();
+	void exit();
+
+	void keyPressed(int key);
+	void keyReleased(int key);
+	void mouseMoved(int x, int y);
+	void mouseDragged(int x, int y, int button);
+	void mousePressed(int x, int y, int button);
+	void mouseReleased(int x, int y, int button);
+	void windowResized(int w, int h);
+	void dragEvent(ofDragInfo dragInfo);
+	void gotMessage(ofMessage msg);
+};
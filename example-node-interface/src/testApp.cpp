@@ -72,7 +72,7 @@ struct PrintClassWrapper : public ofxInteractivePrimitives::BaseWrapper
 
 	static void* create(vector<MessageRef>& input, vector<MessageRef>& output)
 	{
-		input[0] = Message<int>::create(42);
+		input[0] = Message<ofVec3f>::create();
 		return NULL;
 	}
 
@@ -103,7 +103,7 @@ struct PrintClassWrapper : public ofxInteractivePrimitives::BaseWrapper
 
 	static TypeID getInputType(int index)
 	{
-		return Type2Int<int>();
+		return Type2Int<ofVec3f>();
 	}
 };
 
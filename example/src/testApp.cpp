@@ -52,7 +52,7 @@ public:
 	
 	void hittest()
 	{
-		ofRect(0, 0, 100, 100);
+		hitRect(0, 0, 100, 100);
 	}
 	
 	void mouseMoved(int x, int y)
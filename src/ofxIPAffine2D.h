@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace ofxInteractivePrimitives
+{
+	struct Affine2D;
+}
+
+#pragma mark - Affine2D
+
+// 2D affine transform (3x2 plus a z offset), same row vector convention as
+// ofMatrix4x4: p' = p * M, so (A * B) applies A first.
+// used for nodes that only translate, scale and rotate around z.
+
+struct ofxInteractivePrimitives::Affine2D
+{
+	float a, b, c, d, tx, ty, tz;
+
+	Affine2D() : a(1), b(0), c(0), d(1), tx(0), ty(0), tz(0) {}
+
+	// false when m does anything outside of the xy plane
+	static bool fromMatrix(const ofMatrix4x4& mat, Affine2D& out)
+	{
+		const float *m = mat.getPtr();
+
+		if (m[2] != 0 || m[3] != 0
+			|| m[6] != 0 || m[7] != 0
+			|| m[8] != 0 || m[9] != 0 || m[10] != 1 || m[11] != 0
+			|| m[15] != 1) return false;
+
+		out.a = m[0];
+		out.b = m[1];
+		out.c = m[4];
+		out.d = m[5];
+		out.tx = m[12];
+		out.ty = m[13];
+		out.tz = m[14];
+
+		return true;
+	}
+
+	void toMatrix(ofMatrix4x4& mat) const
+	{
+		float m[16] = {
+			a, b, 0, 0,
+			c, d, 0, 0,
+			0, 0, 1, 0,
+			tx, ty, tz, 1
+		};
+
+		mat = ofMatrix4x4(m);
+	}
+
+	Affine2D operator*(const Affine2D& o) const
+	{
+		Affine2D r;
+
+		r.a = a * o.a + b * o.c;
+		r.b = a * o.b + b * o.d;
+		r.c = c * o.a + d * o.c;
+		r.d = c * o.b + d * o.d;
+		r.tx = tx * o.a + ty * o.c + o.tx;
+		r.ty = tx * o.b + ty * o.d + o.ty;
+		r.tz = tz + o.tz;
+
+		return r;
+	}
+
+	// closed form inverse, false when singular
+	bool getInverse(Affine2D& r) const
+	{
+		float det = a * d - b * c;
+		if (det == 0) return false;
+
+		float inv = 1.0 / det;
+
+		r.a = d * inv;
+		r.b = -b * inv;
+		r.c = -c * inv;
+		r.d = a * inv;
+		r.tx = -(tx * r.a + ty * r.c);
+		r.ty = -(tx * r.b + ty * r.d);
+		r.tz = -tz;
+
+		return true;
+	}
+
+	ofVec3f preMult(const ofVec3f& p) const
+	{
+		return ofVec3f(p.x * a + p.y * c + tx,
+					   p.x * b + p.y * d + ty,
+					   p.z + tz);
+	}
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPGLState.h"
+
+namespace ofxInteractivePrimitives
+{
+	class Backend;
+	class GLBackend;
+	class NullBackend;
+}
+
+#pragma mark - Backend
+
+// everything the core needs from the graphics API.
+// GLBackend is the default, NullBackend runs a scene headless: draw() only
+// captures the matrices and picking always uses the CPU path.
+
+class ofxInteractivePrimitives::Backend
+{
+public:
+
+	struct SelectCallback
+	{
+		virtual ~SelectCallback() {}
+		virtual void operator()() = 0;
+	};
+
+	virtual ~Backend() {}
+
+	// viewport and matrices the scene is drawn with
+	virtual void getMatrices(GLint viewport[4], GLdouble projection[16], GLdouble modelview[16]) = 0;
+
+	// false when draw() must not submit anything
+	virtual bool canRender() const = 0;
+
+	// GL_SELECT pick of the 5x5 region around the window position x, y (y down).
+	// the callback issues the hit geometry. returns the number of hit records,
+	// or -1 when the backend can not select. state changes go through state.
+	virtual int select(int x, int y,
+					   const GLint viewport[4], const GLdouble projection[16], const GLdouble modelview[16],
+					   GLuint *buffer, int size, SelectCallback &callback, GLState &state) { return -1; }
+};
+
+#pragma mark - GLBackend
+
+class ofxInteractivePrimitives::GLBackend : public Backend
+{
+public:
+
+	void getMatrices(GLint viewport[4], GLdouble projection[16], GLdouble modelview[16])
+	{
+		glGetDoublev(GL_PROJECTION_MATRIX, projection);
+		glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+	}
+
+	bool canRender() const { return true; }
+
+	int select(int x, int y,
+			   const GLint viewport[4], const GLdouble projection[16], const GLdouble modelview[16],
+			   GLuint *buffer, int size, SelectCallback &callback, GLState &state)
+	{
+		state.begin();
+		state.setEnabled(GL_DEPTH_TEST, true);
+		state.setFill(true);
+
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+
+		glSelectBuffer(size, buffer);
+		glRenderMode(GL_SELECT);
+		glMatrixMode(GL_PROJECTION);
+
+		glPushMatrix();
+		{
+			glLoadIdentity();
+			gluPickMatrix(x, viewport[3] - y, 5.0, 5.0, (GLint*)viewport);
+			glMultMatrixd(projection);
+
+			glMatrixMode(GL_MODELVIEW);
+			glLoadIdentity();
+			glMultMatrixd(modelview);
+
+			// hittest() and the hit helpers set style directly, keep it
+			// from leaking into the next draw
+			ofPushStyle();
+			callback();
+			ofPopStyle();
+
+			glMatrixMode(GL_PROJECTION);
+		}
+		glPopMatrix();
+
+		glMatrixMode(GL_MODELVIEW);
+		glPopMatrix();
+
+		GLint hits = glRenderMode(GL_RENDER);
+
+		state.restore();
+
+		return hits;
+	}
+};
+
+#pragma mark - NullBackend
+
+class ofxInteractivePrimitives::NullBackend : public Backend
+{
+public:
+
+	NullBackend(int width = 1024, int height = 768)
+	{
+		setViewport(width, height);
+	}
+
+	// pixel aligned orthographic view, window y down like ofSetupScreen
+	void setViewport(int width, int height)
+	{
+		viewport[0] = 0;
+		viewport[1] = 0;
+		viewport[2] = width;
+		viewport[3] = height;
+
+		for (int i = 0; i < 16; i++)
+		{
+			projection[i] = (i % 5 == 0) ? 1 : 0;
+			modelview[i] = (i % 5 == 0) ? 1 : 0;
+		}
+
+		// glOrtho(0, width, height, 0, -1, 1)
+		projection[0] = 2.0 / width;
+		projection[5] = -2.0 / height;
+		projection[10] = -1;
+		projection[12] = -1;
+		projection[13] = 1;
+	}
+
+	void setMatrices(const GLint viewport[4], const GLdouble projection[16], const GLdouble modelview[16])
+	{
+		for (int i = 0; i < 4; i++) this->viewport[i] = viewport[i];
+
+		for (int i = 0; i < 16; i++)
+		{
+			this->projection[i] = projection[i];
+			this->modelview[i] = modelview[i];
+		}
+	}
+
+	void getMatrices(GLint viewport[4], GLdouble projection[16], GLdouble modelview[16])
+	{
+		for (int i = 0; i < 4; i++) viewport[i] = this->viewport[i];
+
+		for (int i = 0; i < 16; i++)
+		{
+			projection[i] = this->projection[i];
+			modelview[i] = this->modelview[i];
+		}
+	}
+
+	bool canRender() const { return false; }
+
+protected:
+
+	GLint viewport[4];
+	GLdouble projection[16], modelview[16];
+};
@@ -0,0 +1,431 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxIPGLState.h"
+#include "ofxIPGlyphAtlas.h"
+
+namespace ofxInteractivePrimitives
+{
+	class Batch;
+}
+
+#pragma mark - Batch
+
+// CPU built geometry of many nodes, transformed to world space and grouped
+// by GL state so that a whole run of nodes is submitted in a few draw calls.
+// fills, then lines, then glyphs are drawn, so primitives of overlapping
+// nodes inside one run are layered by kind instead of by node.
+// all text of a run is one stream of quads on the shared GlyphAtlas, in
+// window coordinates like ofDrawBitmapString in its default billboard mode.
+
+class ofxInteractivePrimitives::Batch
+{
+public:
+
+	enum Primitive
+	{
+		TRIANGLES,
+		LINES
+	};
+
+	enum
+	{
+		BITMAP_CHAR_WIDTH = 8,
+		BITMAP_LINE_HEIGHT = 14
+	};
+
+	struct Vertex
+	{
+		float x, y, z;
+		unsigned char r, g, b, a;
+	};
+
+	// vertices sharing one state
+	struct Group
+	{
+		Primitive primitive;
+		float line_width;
+		vector<Vertex> vertices;
+	};
+
+	// x y in window pixels (y down), z is window depth. u v in atlas cell pixels
+	struct GlyphVertex
+	{
+		float x, y, z;
+		float u, v;
+		unsigned char r, g, b, a;
+	};
+
+	// a laid out character, x y is its baseline origin in pixels from the
+	// anchor of its text
+	struct Glyph
+	{
+		char c;
+		int x, y;
+	};
+
+	// window space quads of a node's text, reused while the text, the window
+	// position of its anchor and the color stay the same. invalidate() when
+	// the text changes
+	struct GlyphCache
+	{
+		vector<GlyphVertex> vertices;
+		ofVec3f anchor;
+		ofColor color;
+		bool valid;
+
+		GlyphCache() : valid(false) {}
+
+		void invalidate() { valid = false; }
+	};
+
+	Batch() : default_color(255), color(255), line_width(1)
+	{
+		viewport[0] = viewport[1] = 0;
+		viewport[2] = viewport[3] = 1;
+	}
+
+	// keeps the storage of every group
+	void clear()
+	{
+		for (size_t i = 0; i < groups.size(); i++)
+			groups[i].vertices.clear();
+
+		glyph_vertices.clear();
+	}
+
+	void setDefaultColor(const ofColor& c) { default_color = c; }
+
+	// world to window, text is placed with it. set before the nodes write
+	void setView(const ofMatrix4x4& model_view_projection, const GLint viewport[4])
+	{
+		view_projection = model_view_projection;
+
+		for (int i = 0; i < 4; i++)
+			this->viewport[i] = viewport[i];
+	}
+
+	// called before each node writes into the batch
+	void begin(const ofMatrix4x4& m)
+	{
+		transform = m;
+		resetStyle();
+	}
+
+	void resetStyle()
+	{
+		color = default_color;
+		line_width = 1;
+	}
+
+	void setColor(const ofColor& c) { color = c; }
+	void setColor(const ofColor& c, int alpha) { color = c; color.a = alpha; }
+	void setColor(int r, int g, int b, int a = 255) { color = ofColor(r, g, b, a); }
+
+	void setLineWidth(float w) { line_width = w; }
+
+	void addLine(const ofVec3f& p0, const ofVec3f& p1)
+	{
+		Group &g = getGroup(LINES, line_width);
+		g.vertices.push_back(makeVertex(p0));
+		g.vertices.push_back(makeVertex(p1));
+	}
+
+	void addLine(float x0, float y0, float x1, float y1)
+	{
+		addLine(ofVec3f(x0, y0, 0), ofVec3f(x1, y1, 0));
+	}
+
+	void addRect(const ofRectangle& r, bool filled)
+	{
+		const Vertex v0 = makeVertex(ofVec3f(r.x, r.y, 0));
+		const Vertex v1 = makeVertex(ofVec3f(r.x + r.width, r.y, 0));
+		const Vertex v2 = makeVertex(ofVec3f(r.x + r.width, r.y + r.height, 0));
+		const Vertex v3 = makeVertex(ofVec3f(r.x, r.y + r.height, 0));
+
+		if (filled)
+		{
+			Group &g = getGroup(TRIANGLES, 1);
+			g.vertices.push_back(v0);
+			g.vertices.push_back(v1);
+			g.vertices.push_back(v2);
+			g.vertices.push_back(v0);
+			g.vertices.push_back(v2);
+			g.vertices.push_back(v3);
+		}
+		else
+		{
+			Group &g = getGroup(LINES, line_width);
+			g.vertices.push_back(v0);
+			g.vertices.push_back(v1);
+			g.vertices.push_back(v1);
+			g.vertices.push_back(v2);
+			g.vertices.push_back(v2);
+			g.vertices.push_back(v3);
+			g.vertices.push_back(v3);
+			g.vertices.push_back(v0);
+		}
+	}
+
+	void addRect(float x, float y, float w, float h, bool filled) { addRect(ofRectangle(x, y, w, h), filled); }
+
+	// bitmap font text, x y is the baseline of the first line like
+	// ofDrawBitmapString. only x y follows the node transform, the glyphs
+	// are laid out from there in window pixels, upright and unscaled
+	void addText(const string& text, float x, float y)
+	{
+		ofVec3f anchor;
+		if (!projectAnchor(x, y, anchor)) return;
+
+		int cx = 0, cy = 0;
+
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			const char c = text[i];
+
+			if (c == '\n')
+			{
+				cx = 0;
+				cy += BITMAP_LINE_HEIGHT;
+				continue;
+			}
+
+			if (c != ' ') addGlyph(c, anchor.x + cx, anchor.y + cy, anchor.z);
+
+			cx += BITMAP_CHAR_WIDTH;
+		}
+	}
+
+	// an already laid out text anchored at x y in node space
+	void addGlyphs(const vector<Glyph>& glyphs, float x, float y, GlyphCache &cache)
+	{
+		ofVec3f anchor;
+		if (!projectAnchor(x, y, anchor)) return;
+
+		if (cache.valid && cache.color == color && cache.anchor == anchor)
+		{
+			glyph_vertices.insert(glyph_vertices.end(), cache.vertices.begin(), cache.vertices.end());
+			return;
+		}
+
+		const size_t begin = glyph_vertices.size();
+
+		for (size_t i = 0; i < glyphs.size(); i++)
+			addGlyph(glyphs[i].c, anchor.x + glyphs[i].x, anchor.y + glyphs[i].y, anchor.z);
+
+		cache.vertices.assign(glyph_vertices.begin() + begin, glyph_vertices.end());
+		cache.anchor = anchor;
+		cache.color = color;
+		cache.valid = true;
+	}
+
+	// stats
+
+	const vector<Group>& getGroups() const { return groups; }
+	const vector<GlyphVertex>& getGlyphVertices() const { return glyph_vertices; }
+
+	size_t getNumVertices() const
+	{
+		size_t n = glyph_vertices.size();
+		for (size_t i = 0; i < groups.size(); i++)
+			n += groups[i].vertices.size();
+		return n;
+	}
+
+	// one per non empty group, one for all glyphs
+	int getNumDrawCalls() const
+	{
+		int n = glyph_vertices.empty() ? 0 : 1;
+
+		for (size_t i = 0; i < groups.size(); i++)
+			if (!groups[i].vertices.empty()) n++;
+
+		return n;
+	}
+
+	bool empty() const { return getNumVertices() == 0; }
+
+	// submit with the current GL matrices, returns the number of draw calls.
+	// line width and the glyph alpha test are set through state
+	int draw(GLState &state) const
+	{
+		int calls = 0;
+
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+
+		for (int pass = TRIANGLES; pass <= LINES; pass++)
+		{
+			for (size_t i = 0; i < groups.size(); i++)
+			{
+				const Group &g = groups[i];
+				if (g.primitive != pass || g.vertices.empty()) continue;
+
+				if (g.primitive == LINES) state.setLineWidth(g.line_width);
+
+				glVertexPointer(3, GL_FLOAT, sizeof(Vertex), &g.vertices[0].x);
+				glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &g.vertices[0].r);
+				glDrawArrays(g.primitive == LINES ? GL_LINES : GL_TRIANGLES, 0, g.vertices.size());
+
+				calls++;
+			}
+		}
+
+		if (!glyph_vertices.empty())
+		{
+			// vertex colors modulate the white glyphs, the cell background is cut out
+			state.setEnabled(GL_ALPHA_TEST, true);
+			state.setAlphaFunc(GL_GREATER, 0.5);
+
+			// window pixels y down, z is the window depth of the anchor
+			glMatrixMode(GL_PROJECTION);
+			glPushMatrix();
+			glLoadIdentity();
+			glOrtho(viewport[0], viewport[0] + viewport[2], viewport[3] - viewport[1], -viewport[1], 0, -1);
+
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glLoadIdentity();
+
+			GlyphAtlas &atlas = GlyphAtlas::get();
+			atlas.bind();
+
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+			const GlyphVertex &v = glyph_vertices[0];
+			glVertexPointer(3, GL_FLOAT, sizeof(GlyphVertex), &v.x);
+			glTexCoordPointer(2, GL_FLOAT, sizeof(GlyphVertex), &v.u);
+			glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(GlyphVertex), &v.r);
+			glDrawArrays(GL_TRIANGLES, 0, glyph_vertices.size());
+
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+			atlas.unbind();
+
+			glPopMatrix();
+			glMatrixMode(GL_PROJECTION);
+			glPopMatrix();
+			glMatrixMode(GL_MODELVIEW);
+
+			calls++;
+		}
+
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+
+		// the current color is undefined after a color array, sync it with ofStyle
+		ofSetColor(ofGetStyle().color);
+
+		return calls;
+	}
+
+protected:
+
+	vector<Group> groups;
+	vector<GlyphVertex> glyph_vertices;
+
+	ofMatrix4x4 transform;
+	ofColor default_color, color;
+	float line_width;
+
+	ofMatrix4x4 view_projection;
+	GLint viewport[4];
+
+	Group& getGroup(Primitive primitive, float width)
+	{
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			Group &g = groups[i];
+			if (g.primitive == primitive && g.line_width == width) return g;
+		}
+
+		groups.push_back(Group());
+
+		Group &g = groups.back();
+		g.primitive = primitive;
+		g.line_width = width;
+
+		return g;
+	}
+
+	Vertex makeVertex(const ofVec3f& p) const
+	{
+		const ofVec3f w = transform.preMult(p);
+
+		Vertex v;
+		v.x = w.x;
+		v.y = w.y;
+		v.z = w.z;
+		v.r = color.r;
+		v.g = color.g;
+		v.b = color.b;
+		v.a = color.a;
+
+		return v;
+	}
+
+	// node space x y to window coordinates (y down) at whole pixels, the
+	// atlas is not filtered. false behind the eye
+	bool projectAnchor(float x, float y, ofVec3f& out) const
+	{
+		const ofVec3f w = transform.preMult(ofVec3f(x, y, 0));
+		const float *m = view_projection.getPtr();
+
+		float cx = w.x * m[0] + w.y * m[4] + w.z * m[8] + m[12];
+		float cy = w.x * m[1] + w.y * m[5] + w.z * m[9] + m[13];
+		float cz = w.x * m[2] + w.y * m[6] + w.z * m[10] + m[14];
+		float cw = w.x * m[3] + w.y * m[7] + w.z * m[11] + m[15];
+
+		if (cw <= 0) return false;
+
+		out.x = floor(viewport[0] + (cx / cw + 1) * 0.5f * viewport[2] + 0.5f);
+		out.y = floor(viewport[3] - (viewport[1] + (cy / cw + 1) * 0.5f * viewport[3]) + 0.5f);
+		out.z = (cz / cw + 1) * 0.5f;
+
+		return true;
+	}
+
+	// one character, x y is its baseline origin in window pixels
+	void addGlyph(char c, float x, float y, float z)
+	{
+		const float x0 = x;
+		const float y0 = y - GlyphAtlas::BASELINE;
+		const float x1 = x0 + GlyphAtlas::CELL_WIDTH;
+		const float y1 = y0 + GlyphAtlas::CELL_HEIGHT;
+
+		float u0, v0;
+		GlyphAtlas::getCell(c, u0, v0);
+
+		const float u1 = u0 + GlyphAtlas::CELL_WIDTH;
+		const float v1 = v0 + GlyphAtlas::CELL_HEIGHT;
+
+		const GlyphVertex a = makeGlyphVertex(x0, y0, z, u0, v0);
+		const GlyphVertex b = makeGlyphVertex(x1, y0, z, u1, v0);
+		const GlyphVertex d = makeGlyphVertex(x1, y1, z, u1, v1);
+		const GlyphVertex e = makeGlyphVertex(x0, y1, z, u0, v1);
+
+		glyph_vertices.push_back(a);
+		glyph_vertices.push_back(b);
+		glyph_vertices.push_back(d);
+		glyph_vertices.push_back(a);
+		glyph_vertices.push_back(d);
+		glyph_vertices.push_back(e);
+	}
+
+	GlyphVertex makeGlyphVertex(float x, float y, float z, float u, float v) const
+	{
+		GlyphVertex g;
+		g.x = x;
+		g.y = y;
+		g.z = z;
+		g.u = u;
+		g.v = v;
+		g.r = color.r;
+		g.g = color.g;
+		g.b = color.b;
+		g.a = color.a;
+
+		return g;
+	}
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace ofxInteractivePrimitives
+{
+	class GLState;
+}
+
+#pragma mark - GLState
+
+// tracks the GL and ofStyle state the addon itself changes.
+// a value is read the first time it is set after begin(), restore() puts
+// back only what differs from that. setting a value that is already
+// current is skipped and counted as redundant.
+
+class ofxInteractivePrimitives::GLState
+{
+public:
+
+	GLState() : num_changes(0), num_redundant(0) { begin(); }
+
+	void begin()
+	{
+		caps.clear();
+		color.saved = fill.saved = line_width.saved = alpha_func.saved = false;
+	}
+
+	void restore()
+	{
+		for (size_t i = 0; i < caps.size(); i++)
+		{
+			Capability &c = caps[i];
+			if (c.current != c.original) applyEnabled(c.cap, c.original);
+		}
+
+		if (color.saved && color.current != color.original) ofSetColor(color.original);
+
+		if (fill.saved && fill.current != fill.original)
+		{
+			if (fill.original) ofFill();
+			else ofNoFill();
+		}
+
+		if (line_width.saved && line_width.current != line_width.original) ofSetLineWidth(line_width.original);
+
+		if (alpha_func.saved && alpha_func.current != alpha_func.original)
+			glAlphaFunc(alpha_func.original.func, alpha_func.original.ref);
+
+		begin();
+	}
+
+	void setEnabled(GLenum cap, bool v)
+	{
+		Capability *c = findCapability(cap);
+
+		if (c == NULL)
+		{
+			Capability n;
+			n.cap = cap;
+			n.original = n.current = glIsEnabled(cap);
+			caps.push_back(n);
+			c = &caps.back();
+		}
+
+		if (c->current == v)
+		{
+			num_redundant++;
+			return;
+		}
+
+		c->current = v;
+		applyEnabled(cap, v);
+		num_changes++;
+	}
+
+	void setColor(const ofColor& v)
+	{
+		if (!color.saved) color.save(ofGetStyle().color);
+
+		if (color.current == v)
+		{
+			num_redundant++;
+			return;
+		}
+
+		color.current = v;
+		ofSetColor(v);
+		num_changes++;
+	}
+
+	void setFill(bool v)
+	{
+		if (!fill.saved) fill.save(ofGetStyle().bFill == OF_FILLED);
+
+		if (fill.current == v)
+		{
+			num_redundant++;
+			return;
+		}
+
+		fill.current = v;
+		if (v) ofFill();
+		else ofNoFill();
+		num_changes++;
+	}
+
+	void setLineWidth(float v)
+	{
+		if (!line_width.saved) line_width.save(ofGetStyle().lineWidth);
+
+		if (line_width.current == v)
+		{
+			num_redundant++;
+			return;
+		}
+
+		line_width.current = v;
+		ofSetLineWidth(v);
+		num_changes++;
+	}
+
+	void setAlphaFunc(GLenum func, float ref)
+	{
+		if (!alpha_func.saved)
+		{
+			GLint f;
+			GLfloat r;
+			glGetIntegerv(GL_ALPHA_TEST_FUNC, &f);
+			glGetFloatv(GL_ALPHA_TEST_REF, &r);
+			alpha_func.save(AlphaFunc(f, r));
+		}
+
+		const AlphaFunc v(func, ref);
+
+		if (alpha_func.current == v)
+		{
+			num_redundant++;
+			return;
+		}
+
+		alpha_func.current = v;
+		glAlphaFunc(func, ref);
+		num_changes++;
+	}
+
+	// counters, reset once per frame by RootNode::update
+
+	unsigned int getNumChanges() const { return num_changes; }
+	unsigned int getNumRedundantChanges() const { return num_redundant; }
+
+	void resetCounters()
+	{
+		num_changes = 0;
+		num_redundant = 0;
+	}
+
+protected:
+
+	template <typename T>
+	struct Value
+	{
+		T original, current;
+		bool saved;
+
+		Value() : saved(false) {}
+
+		void save(const T& v)
+		{
+			original = current = v;
+			saved = true;
+		}
+	};
+
+	struct AlphaFunc
+	{
+		GLenum func;
+		float ref;
+
+		AlphaFunc(GLenum func = GL_ALWAYS, float ref = 0) : func(func), ref(ref) {}
+
+		bool operator==(const AlphaFunc& o) const { return func == o.func && ref == o.ref; }
+		bool operator!=(const AlphaFunc& o) const { return !(*this == o); }
+	};
+
+	struct Capability
+	{
+		GLenum cap;
+		bool original, current;
+	};
+
+	vector<Capability> caps;
+
+	Value<ofColor> color;
+	Value<bool> fill;
+	Value<float> line_width;
+	Value<AlphaFunc> alpha_func;
+
+	unsigned int num_changes, num_redundant;
+
+	Capability* findCapability(GLenum cap)
+	{
+		for (size_t i = 0; i < caps.size(); i++)
+			if (caps[i].cap == cap) return &caps[i];
+		return NULL;
+	}
+
+	static void applyEnabled(GLenum cap, bool v)
+	{
+		if (v) glEnable(cap);
+		else glDisable(cap);
+	}
+};
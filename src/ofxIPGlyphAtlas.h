@@ -0,0 +1,120 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofBitmapFont.h"
+
+namespace ofxInteractivePrimitives
+{
+	class GlyphAtlas;
+}
+
+#pragma mark - GlyphAtlas
+
+// the bitmap font rendered once into a 16x16 grid of cells, shared by
+// every RootNode. texture coordinates are given in cell pixels, top down;
+// bind() sets up the texture matrix that maps them to the fbo texture.
+// the atlas is never destroyed, the GL context may be gone at exit.
+
+class ofxInteractivePrimitives::GlyphAtlas
+{
+public:
+
+	enum
+	{
+		CELL_WIDTH = 8,
+		CELL_HEIGHT = 16,
+
+		// baseline inside a cell, room for ascenders and descenders
+		BASELINE = 12,
+
+		COLUMNS = 16,
+		ROWS = 16,
+
+		WIDTH = CELL_WIDTH * COLUMNS,
+		HEIGHT = CELL_HEIGHT * ROWS
+	};
+
+	static GlyphAtlas& get()
+	{
+		static GlyphAtlas *atlas = new GlyphAtlas;
+		return *atlas;
+	}
+
+	// top left of the cell of c
+	static void getCell(unsigned char c, float& u, float& v)
+	{
+		u = (c % COLUMNS) * CELL_WIDTH;
+		v = (c / COLUMNS) * CELL_HEIGHT;
+	}
+
+	bool isAllocated() const { return allocated; }
+
+	// needs a GL context
+	void allocate()
+	{
+		if (allocated) return;
+
+		fbo.allocate(WIDTH, HEIGHT, GL_RGBA);
+
+		fbo.begin();
+		ofClear(255, 255, 255, 0);
+
+		ofPushStyle();
+		ofSetColor(255);
+
+		ofDrawBitmapCharacterStart(COLUMNS * ROWS);
+
+		for (int c = 0; c < COLUMNS * ROWS; c++)
+		{
+			float u, v;
+			getCell(c, u, v);
+			ofDrawBitmapCharacter(c, u, v + BASELINE);
+		}
+
+		ofDrawBitmapCharacterEnd();
+
+		ofPopStyle();
+		fbo.end();
+
+		// glyphs are drawn upright at whole pixels, no filtering
+		fbo.getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+
+		allocated = true;
+	}
+
+	void bind()
+	{
+		allocate();
+
+		ofTexture &tex = fbo.getTextureReference();
+
+		// cell pixels to texture coordinates, flipped like ofFbo::draw
+		const ofPoint extent = tex.getCoordFromPoint(WIDTH, HEIGHT);
+
+		glMatrixMode(GL_TEXTURE);
+		glPushMatrix();
+		glLoadIdentity();
+		glScalef(extent.x / WIDTH, extent.y / HEIGHT, 1);
+		glTranslatef(0, HEIGHT, 0);
+		glScalef(1, -1, 1);
+		glMatrixMode(GL_MODELVIEW);
+
+		tex.bind();
+	}
+
+	void unbind()
+	{
+		fbo.getTextureReference().unbind();
+
+		glMatrixMode(GL_TEXTURE);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+	}
+
+protected:
+
+	ofFbo fbo;
+	bool allocated;
+
+	GlyphAtlas() : allocated(false) {}
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <assert.h>
+
+namespace ofxInteractivePrimitives
+{
+	class Pool;
+
+	template <typename T, bool Shared>
+	struct Pooled;
+}
+
+#pragma mark - Pool
+
+// fixed size object pool: slabs of objects_per_slab blocks threaded on a free list.
+// every pool registers itself so that getStats() and trimAll() see all of them.
+// pools are never destroyed, objects may outlive any static destruction order.
+// only a shared pool is locked, e.g. messages created and released on
+// ThreadPool workers. the others belong to the thread that runs the UI.
+
+class ofxInteractivePrimitives::Pool
+{
+public:
+
+	struct Stats
+	{
+		string name;
+		size_t object_size;
+		size_t num_live, peak_live;
+		size_t num_slabs, capacity;
+		unsigned long long num_allocations;
+	};
+
+	Pool(const string& name, size_t size, size_t objects_per_slab = 256, bool shared = false)
+		: name(name), objects_per_slab(objects_per_slab), shared(shared), free_list(NULL), num_live(0), peak_live(0), num_allocations(0)
+	{
+		// room for the free list link, keep every block 8 byte aligned
+		object_size = max(size, sizeof(FreeBlock));
+		object_size = (object_size + 7) & ~(size_t)7;
+
+		getPools().push_back(this);
+	}
+
+	void* allocate()
+	{
+		Lock lock(*this);
+
+		if (free_list == NULL) addSlab();
+
+		FreeBlock *b = free_list;
+		free_list = b->next;
+
+		num_live++;
+		num_allocations++;
+		if (num_live > peak_live) peak_live = num_live;
+
+		return b;
+	}
+
+	void deallocate(void *p)
+	{
+		if (p == NULL) return;
+
+		Lock lock(*this);
+
+		assert(num_live > 0);
+
+		FreeBlock *b = (FreeBlock*)p;
+		b->next = free_list;
+		free_list = b;
+
+		num_live--;
+	}
+
+	// give slabs without live objects back to the heap
+	void trim()
+	{
+		Lock lock(*this);
+
+		if (slabs.empty()) return;
+
+		if (num_live == 0)
+		{
+			for (size_t i = 0; i < slabs.size(); i++)
+				::operator delete(slabs[i]);
+
+			slabs.clear();
+			free_list = NULL;
+			return;
+		}
+
+		// count free blocks per slab, slabs are kept sorted by address
+		vector<size_t> free_count(slabs.size(), 0);
+
+		for (FreeBlock *b = free_list; b; b = b->next)
+			free_count[findSlab(b)]++;
+
+		vector<char*> keep;
+		for (size_t i = 0; i < slabs.size(); i++)
+		{
+			if (free_count[i] == objects_per_slab)
+				::operator delete(slabs[i]);
+			else
+				keep.push_back(slabs[i]);
+		}
+
+		if (keep.size() == slabs.size()) return;
+
+		// drop the blocks of the released slabs from the free list
+		FreeBlock *head = NULL;
+		for (FreeBlock *b = free_list, *next; b; b = next)
+		{
+			next = b->next;
+
+			if (free_count[findSlab(b)] == objects_per_slab) continue;
+
+			b->next = head;
+			head = b;
+		}
+
+		free_list = head;
+		slabs.swap(keep);
+	}
+
+	Stats getStats() const
+	{
+		Lock lock(*this);
+
+		Stats s;
+		s.name = name;
+		s.object_size = object_size;
+		s.num_live = num_live;
+		s.peak_live = peak_live;
+		s.num_slabs = slabs.size();
+		s.capacity = slabs.size() * objects_per_slab;
+		s.num_allocations = num_allocations;
+		return s;
+	}
+
+	// registry
+
+	static void getAllStats(vector<Stats>& out)
+	{
+		out.clear();
+
+		vector<Pool*> &pools = getPools();
+		for (size_t i = 0; i < pools.size(); i++)
+			out.push_back(pools[i]->getStats());
+	}
+
+	static void trimAll()
+	{
+		vector<Pool*> &pools = getPools();
+		for (size_t i = 0; i < pools.size(); i++)
+			pools[i]->trim();
+	}
+
+protected:
+
+	struct FreeBlock
+	{
+		FreeBlock *next;
+	};
+
+	string name;
+	size_t object_size, objects_per_slab;
+
+	bool shared;
+	mutable ofMutex mutex;
+
+	struct Lock
+	{
+		const Pool &pool;
+
+		Lock(const Pool &pool) : pool(pool) { if (pool.shared) pool.mutex.lock(); }
+		~Lock() { if (pool.shared) pool.mutex.unlock(); }
+	};
+
+	vector<char*> slabs;
+	FreeBlock *free_list;
+
+	size_t num_live, peak_live;
+	unsigned long long num_allocations;
+
+	static vector<Pool*>& getPools()
+	{
+		static vector<Pool*> *pools = new vector<Pool*>;
+		return *pools;
+	}
+
+	void addSlab()
+	{
+		char *slab = (char*)::operator new(object_size * objects_per_slab);
+		slabs.insert(upper_bound(slabs.begin(), slabs.end(), slab), slab);
+
+		// thread backwards so that allocation walks the slab forwards
+		for (size_t i = objects_per_slab; i > 0; i--)
+		{
+			FreeBlock *b = (FreeBlock*)(slab + (i - 1) * object_size);
+			b->next = free_list;
+			free_list = b;
+		}
+	}
+
+	size_t findSlab(const void *p) const
+	{
+		vector<char*>::const_iterator it = upper_bound(slabs.begin(), slabs.end(), (char*)p);
+		assert(it != slabs.begin());
+
+		return (it - slabs.begin()) - 1;
+	}
+};
+
+#pragma mark - Pooled
+
+// mixin that routes new/delete of T through a pool of its own.
+// subclasses of T with a different size fall back to the global heap.
+// Shared locks the pool, for objects allocated on more than one thread.
+//
+//   class MyNode : public Node, public Pooled<MyNode> { ... };
+
+template <typename T, bool Shared = false>
+struct ofxInteractivePrimitives::Pooled
+{
+	static void* operator new(size_t size)
+	{
+		if (size != sizeof(T)) return ::operator new(size);
+		return getPool().allocate();
+	}
+
+	static void operator delete(void *p, size_t size)
+	{
+		if (size != sizeof(T)) ::operator delete(p);
+		else getPool().deallocate(p);
+	}
+
+	static Pool& getPool()
+	{
+		static Pool *pool = new Pool(typeid(T).name(), sizeof(T), 256, Shared);
+		return *pool;
+	}
+};
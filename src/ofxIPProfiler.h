@@ -0,0 +1,297 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <typeinfo>
+
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+
+namespace ofxInteractivePrimitives
+{
+	class Profiler;
+}
+
+#pragma mark - Profiler
+
+// times node callbacks and picks.
+// stats are aggregated per class and per instance over windows of
+// getWindowFrames() frames, the last completed window is what the getters
+// return. samples are also kept as trace events for chrome://tracing.
+// disabled, every scope costs one branch.
+
+class ofxInteractivePrimitives::Profiler
+{
+public:
+
+	enum Phase
+	{
+		UPDATE,
+		DRAW,
+		HITTEST,
+		PICKUP,
+		NUM_PHASES
+	};
+
+	struct Stats
+	{
+		unsigned int count;
+		unsigned long long total_us, max_us;
+
+		Stats() : count(0), total_us(0), max_us(0) {}
+
+		void add(unsigned long long us)
+		{
+			count++;
+			total_us += us;
+			if (us > max_us) max_us = us;
+		}
+
+		float getMean() const { return count ? (float)total_us / count : 0; }
+	};
+
+	struct ClassStats
+	{
+		string name;
+		Stats stats;
+	};
+
+	// times the enclosing block. object is only looked at when enabled
+	template <typename T>
+	struct Scope
+	{
+		Scope(Profiler *profiler, Phase phase, const T *object = NULL, unsigned int object_id = 0)
+			: profiler(profiler && profiler->isEnabled() ? profiler : NULL), phase(phase), object(object), object_id(object_id)
+		{
+			if (this->profiler) start = ofGetElapsedTimeMicros();
+		}
+
+		~Scope()
+		{
+			if (profiler) profiler->record(phase, object ? &typeid(*object) : NULL, object_id, start, ofGetElapsedTimeMicros());
+		}
+
+	private:
+
+		Profiler *profiler;
+		Phase phase;
+		const T *object;
+		unsigned int object_id;
+		unsigned long long start;
+	};
+
+	Profiler() : enabled(false), window_frames(120), frame(0), max_trace_events(1 << 20), dropped_trace_events(0) {}
+
+	void setEnabled(bool v)
+	{
+		if (enabled == v) return;
+		enabled = v;
+
+		if (enabled)
+		{
+			frame = 0;
+			for (int i = 0; i < NUM_PHASES; i++)
+			{
+				current[i].clear();
+				current_instances[i].clear();
+			}
+		}
+	}
+
+	bool isEnabled() const { return enabled; }
+
+	void setWindowFrames(int v) { window_frames = max(1, v); }
+	int getWindowFrames() const { return window_frames; }
+
+	// trace events beyond this are dropped until clearTrace()
+	void setMaxTraceEvents(size_t v) { max_trace_events = v; }
+
+	// called once per RootNode::update
+	void frameStarted()
+	{
+		if (!enabled) return;
+
+		if (++frame < window_frames) return;
+
+		frame = 0;
+
+		for (int i = 0; i < NUM_PHASES; i++)
+		{
+			last[i].swap(current[i]);
+			current[i].clear();
+
+			last_instances[i].swap(current_instances[i]);
+			current_instances[i].clear();
+		}
+	}
+
+	void record(Phase phase, const std::type_info *type, unsigned int object_id, unsigned long long start, unsigned long long end)
+	{
+		unsigned long long us = end - start;
+
+		current[phase][TypeKey(type)].add(us);
+
+		if (object_id != 0)
+		{
+			InstanceStats &s = current_instances[phase][object_id];
+			s.type = type;
+			s.stats.add(us);
+		}
+
+		if (trace.size() < max_trace_events)
+		{
+			TraceEvent e;
+			e.phase = phase;
+			e.type = type;
+			e.object_id = object_id;
+			e.start = start;
+			e.duration = us;
+			trace.push_back(e);
+		}
+		else dropped_trace_events++;
+	}
+
+	// last completed window, sorted by total time
+	void getClassStats(Phase phase, vector<ClassStats>& out) const
+	{
+		out.clear();
+
+		ClassMap::const_iterator it = last[phase].begin();
+		while (it != last[phase].end())
+		{
+			ClassStats s;
+			s.name = getTypeName(it->first.type, phase);
+			s.stats = it->second;
+			out.push_back(s);
+			it++;
+		}
+
+		sort(out.begin(), out.end(), compareTotal);
+	}
+
+	// last completed window, NULL when the object was not sampled
+	const Stats* getInstanceStats(Phase phase, unsigned int object_id) const
+	{
+		InstanceMap::const_iterator it = last_instances[phase].find(object_id);
+		if (it == last_instances[phase].end()) return NULL;
+
+		return &it->second.stats;
+	}
+
+	void clearTrace()
+	{
+		trace.clear();
+		dropped_trace_events = 0;
+	}
+
+	size_t getNumTraceEvents() const { return trace.size(); }
+	size_t getNumDroppedTraceEvents() const { return dropped_trace_events; }
+
+	// Trace Event Format, load with chrome://tracing
+	void writeChromeTrace(ostream &os) const
+	{
+		map<const std::type_info*, string> names;
+
+		os << "{\"traceEvents\":[\n";
+
+		for (size_t i = 0; i < trace.size(); i++)
+		{
+			const TraceEvent &e = trace[i];
+
+			string &name = names[e.type];
+			if (name.empty()) name = getTypeName(e.type, e.phase);
+
+			os << "{\"name\":\"" << name << "\",\"cat\":\"" << getPhaseName(e.phase) << "\"";
+			os << ",\"ph\":\"X\",\"pid\":0,\"tid\":0";
+			os << ",\"ts\":" << e.start << ",\"dur\":" << e.duration;
+			os << ",\"args\":{\"id\":" << e.object_id << "}}";
+			os << (i + 1 < trace.size() ? ",\n" : "\n");
+		}
+
+		os << "],\"displayTimeUnit\":\"ms\"}\n";
+	}
+
+	bool saveChromeTrace(const string& path) const
+	{
+		ofstream ofs(ofToDataPath(path).c_str());
+		if (!ofs) return false;
+
+		writeChromeTrace(ofs);
+		return true;
+	}
+
+	static const char* getPhaseName(Phase phase)
+	{
+		static const char* names[] = { "update", "draw", "hittest", "pickup" };
+		return names[phase];
+	}
+
+	static string getTypeName(const std::type_info *type, Phase phase)
+	{
+		if (type == NULL) return getPhaseName(phase);
+
+		string name = type->name();
+
+#ifdef __GNUC__
+		int status = 0;
+		char *demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+		if (demangled)
+		{
+			if (status == 0) name = demangled;
+			free(demangled);
+		}
+#endif
+
+		return name;
+	}
+
+protected:
+
+	// type_info objects are not guaranteed unique, order them with before()
+	struct TypeKey
+	{
+		const std::type_info *type;
+
+		TypeKey(const std::type_info *type) : type(type) {}
+
+		bool operator<(const TypeKey& o) const
+		{
+			if (type == NULL || o.type == NULL) return type < o.type;
+			return type->before(*o.type) != 0;
+		}
+	};
+
+	struct InstanceStats
+	{
+		const std::type_info *type;
+		Stats stats;
+
+		InstanceStats() : type(NULL) {}
+	};
+
+	struct TraceEvent
+	{
+		Phase phase;
+		const std::type_info *type;
+		unsigned int object_id;
+		unsigned long long start, duration;
+	};
+
+	typedef map<TypeKey, Stats> ClassMap;
+	typedef map<unsigned int, InstanceStats> InstanceMap;
+
+	bool enabled;
+	int window_frames, frame;
+
+	ClassMap current[NUM_PHASES], last[NUM_PHASES];
+	InstanceMap current_instances[NUM_PHASES], last_instances[NUM_PHASES];
+
+	vector<TraceEvent> trace;
+	size_t max_trace_events, dropped_trace_events;
+
+	static bool compareTotal(const ClassStats& a, const ClassStats& b)
+	{
+		return a.stats.total_us > b.stats.total_us;
+	}
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <assert.h>
+
+namespace ofxInteractivePrimitives
+{
+	template <typename T>
+	class SlotMap;
+}
+
+#pragma mark - SlotMap
+
+// generational slot map of pointers.
+// ids pack a slot index and a generation, slots are recycled and a stale id
+// from a removed value never resolves to the value that reuses its slot.
+// values are kept dense for iteration, removal swaps with the last one.
+// ids are GL names and stay 32 bit, a slot whose generations are used up is
+// retired instead of wrapping around.
+
+template <typename T>
+class ofxInteractivePrimitives::SlotMap
+{
+public:
+
+	typedef unsigned int ID;
+
+	enum
+	{
+		INDEX_BITS = 20,
+		INDEX_MASK = (1 << INDEX_BITS) - 1,
+		GENERATION_MASK = (1 << (32 - INDEX_BITS)) - 1
+	};
+
+	// 0 is never handed out, use it as "no id"
+	static const ID INVALID_ID = 0;
+
+	ID insert(T *value)
+	{
+		unsigned int index;
+
+		if (!free_slots.empty())
+		{
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+		else
+		{
+			assert(slots.size() <= INDEX_MASK);
+
+			index = slots.size();
+
+			Slot s;
+			s.generation = 1;
+			slots.push_back(s);
+		}
+
+		Slot &s = slots[index];
+		s.dense_index = values.size();
+
+		values.push_back(value);
+		dense_to_slot.push_back(index);
+
+		return (s.generation << INDEX_BITS) | index;
+	}
+
+	bool erase(ID id)
+	{
+		Slot *s = getSlot(id);
+		if (s == NULL) return false;
+
+		unsigned int index = id & INDEX_MASK;
+		unsigned int d = s->dense_index;
+		unsigned int last = values.size() - 1;
+
+		if (d != last)
+		{
+			values[d] = values[last];
+			dense_to_slot[d] = dense_to_slot[last];
+			slots[dense_to_slot[d]].dense_index = d;
+		}
+
+		values.pop_back();
+		dense_to_slot.pop_back();
+
+		release(index);
+
+		return true;
+	}
+
+	T* find(ID id) const
+	{
+		const Slot *s = getSlot(id);
+		if (s == NULL) return NULL;
+
+		return values[s->dense_index];
+	}
+
+	bool contains(ID id) const { return getSlot(id) != NULL; }
+
+	// dense access, order changes on erase
+	size_t size() const { return values.size(); }
+	bool empty() const { return values.empty(); }
+	T* at(size_t i) const { return values[i]; }
+
+	void clear()
+	{
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			release(dense_to_slot[i]);
+		}
+
+		values.clear();
+		dense_to_slot.clear();
+	}
+
+protected:
+
+	struct Slot
+	{
+		unsigned int generation;
+		unsigned int dense_index;
+	};
+
+	vector<T*> values;
+	vector<unsigned int> dense_to_slot;
+
+	vector<Slot> slots;
+	vector<unsigned int> free_slots;
+
+	// next generation for the slot. at the last one the slot is never
+	// handed out again, so its stale ids keep resolving to nothing
+	void release(unsigned int index)
+	{
+		Slot &s = slots[index];
+		if (s.generation == GENERATION_MASK) return;
+
+		s.generation++;
+		free_slots.push_back(index);
+	}
+
+	const Slot* getSlot(ID id) const
+	{
+		unsigned int index = id & INDEX_MASK;
+		if (index >= slots.size()) return NULL;
+
+		const Slot &s = slots[index];
+		if (s.generation != (id >> INDEX_BITS)) return NULL;
+
+		// generation matches a freed slot only until it is reused
+		if (s.dense_index >= values.size() || dense_to_slot[s.dense_index] != index) return NULL;
+
+		return &s;
+	}
+
+	Slot* getSlot(ID id)
+	{
+		return const_cast<Slot*>(static_cast<const SlotMap*>(this)->getSlot(id));
+	}
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace ofxInteractivePrimitives
+{
+	struct Bounds;
+	class SpatialIndex;
+}
+
+#pragma mark - Bounds
+
+struct ofxInteractivePrimitives::Bounds
+{
+	ofVec3f min, max;
+	bool valid;
+
+	Bounds() : valid(false) {}
+
+	void clear() { valid = false; }
+
+	void grow(const ofVec3f& p)
+	{
+		if (!valid)
+		{
+			min = max = p;
+			valid = true;
+			return;
+		}
+
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.z < min.z) min.z = p.z;
+
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+		if (p.z > max.z) max.z = p.z;
+	}
+
+	void grow(const Bounds& b)
+	{
+		if (!b.valid) return;
+
+		grow(b.min);
+		grow(b.max);
+	}
+
+	// transform a local rect on the z = 0 plane and accumulate its corners
+	void grow(const ofRectangle& r, const ofMatrix4x4& m)
+	{
+		grow(m.preMult(ofVec3f(r.x, r.y, 0)));
+		grow(m.preMult(ofVec3f(r.x + r.width, r.y, 0)));
+		grow(m.preMult(ofVec3f(r.x, r.y + r.height, 0)));
+		grow(m.preMult(ofVec3f(r.x + r.width, r.y + r.height, 0)));
+	}
+
+	ofVec3f getCenter() const { return (min + max) * 0.5; }
+
+	ofVec3f getCorner(int i) const
+	{
+		return ofVec3f(i & 1 ? max.x : min.x,
+					   i & 2 ? max.y : min.y,
+					   i & 4 ? max.z : min.z);
+	}
+};
+
+#pragma mark - SpatialIndex
+
+// bounding volume hierarchy over world space node bounds, keyed by object id.
+// rebuilt from the bounds cached during update, queried by picking.
+
+class ofxInteractivePrimitives::SpatialIndex
+{
+public:
+
+	void clear()
+	{
+		entries.clear();
+		tree.clear();
+	}
+
+	void add(unsigned int object_id, const Bounds& bounds)
+	{
+		if (!bounds.valid) return;
+
+		Entry e;
+		e.object_id = object_id;
+		e.bounds = bounds;
+		e.center = bounds.getCenter();
+		entries.push_back(e);
+	}
+
+	void build()
+	{
+		tree.clear();
+		if (entries.empty()) return;
+
+		tree.reserve(entries.size() * 2);
+		tree.push_back(TreeNode());
+
+		buildInto(0, 0, entries.size());
+	}
+
+	size_t size() const { return entries.size(); }
+
+	// Test must provide `bool operator()(const Bounds&)`.
+	// ids of the matched entries are appended to result, candidates only.
+	template <typename Test>
+	void query(Test &test, vector<unsigned int> &result) const
+	{
+		if (tree.empty()) return;
+
+		int stack[64];
+		int sp = 0;
+
+		stack[sp++] = 0;
+
+		while (sp > 0)
+		{
+			const TreeNode &n = tree[stack[--sp]];
+
+			if (!test(n.bounds)) continue;
+
+			if (n.count > 0)
+			{
+				for (int i = n.first; i < n.first + n.count; i++)
+				{
+					const Entry &e = entries[i];
+					if (test(e.bounds)) result.push_back(e.object_id);
+				}
+			}
+			else if (sp + 2 <= 64)
+			{
+				stack[sp++] = n.first;
+				stack[sp++] = n.first + 1;
+			}
+		}
+	}
+
+protected:
+
+	enum
+	{
+		LEAF_SIZE = 4
+	};
+
+	struct Entry
+	{
+		unsigned int object_id;
+		Bounds bounds;
+		ofVec3f center;
+	};
+
+	// count > 0: leaf over entries[first, first + count)
+	// count == 0: inner node, children at tree[first] and tree[first + 1]
+	struct TreeNode
+	{
+		Bounds bounds;
+		int first, count;
+	};
+
+	struct CompareAxis
+	{
+		int axis;
+		CompareAxis(int axis) : axis(axis) {}
+
+		bool operator()(const Entry &a, const Entry &b) const
+		{
+			return component(a.center, axis) < component(b.center, axis);
+		}
+	};
+
+	vector<Entry> entries;
+	vector<TreeNode> tree;
+
+	static float component(const ofVec3f& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+
+	void buildInto(int index, size_t begin, size_t end)
+	{
+		Bounds bounds, centers;
+		for (size_t i = begin; i < end; i++)
+		{
+			bounds.grow(entries[i].bounds);
+			centers.grow(entries[i].center);
+		}
+
+		tree[index].bounds = bounds;
+
+		if (end - begin <= LEAF_SIZE)
+		{
+			tree[index].first = begin;
+			tree[index].count = end - begin;
+			return;
+		}
+
+		// median split along the longest axis of the centers
+		ofVec3f extent = centers.max - centers.min;
+		int axis = 0;
+		if (extent.y > extent.x) axis = 1;
+		if (extent.z > component(extent, axis)) axis = 2;
+
+		size_t mid = begin + (end - begin) / 2;
+		nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, CompareAxis(axis));
+
+		// children are allocated as a pair so that the right child is always first + 1
+		int left = tree.size();
+		tree.push_back(TreeNode());
+		tree.push_back(TreeNode());
+
+		buildInto(left, begin, mid);
+		buildInto(left + 1, mid, end);
+
+		tree[index].first = left;
+		tree[index].count = 0;
+	}
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include "Poco/Event.h"
+
+#include <deque>
+
+namespace ofxInteractivePrimitives
+{
+	class ThreadPool;
+}
+
+#pragma mark - ThreadPool
+
+// work stealing pool: every worker owns a deque, takes its own newest task
+// and steals the oldest task of another worker when it runs dry.
+// the thread that waits for the work can run tasks too, as worker -1.
+
+class ofxInteractivePrimitives::ThreadPool
+{
+public:
+
+	struct Task
+	{
+		virtual ~Task() {}
+
+		// worker is the index of the calling worker, -1 for an outside thread
+		virtual void run(int worker) = 0;
+	};
+
+	ThreadPool(int num_threads) : next_queue(0)
+	{
+		num_threads = max(1, num_threads);
+
+		for (int i = 0; i < num_threads; i++)
+			workers.push_back(new Worker(this, i));
+
+		for (int i = 0; i < num_threads; i++)
+			workers[i]->startThread(true, false);
+	}
+
+	~ThreadPool()
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i]->stopThread();
+			workers[i]->wake.set();
+		}
+
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i]->waitForThread(false);
+			delete workers[i];
+		}
+	}
+
+	int getNumThreads() const { return workers.size(); }
+
+	// a worker pushes onto its own deque, anything else spreads round robin
+	void submit(Task *task, int worker = -1)
+	{
+		if (worker < 0 || worker >= (int)workers.size())
+		{
+			ofMutex::ScopedLock lock(submit_mutex);
+			worker = next_queue;
+			next_queue = (next_queue + 1) % workers.size();
+		}
+
+		Worker *w = workers[worker];
+
+		{
+			ofMutex::ScopedLock lock(w->mutex);
+			w->tasks.push_back(task);
+		}
+
+		w->wake.set();
+	}
+
+	// run one queued task on the calling thread, false when there was none
+	bool runPending(int worker = -1)
+	{
+		Task *task = take(worker);
+		if (task == NULL) return false;
+
+		task->run(worker);
+		return true;
+	}
+
+protected:
+
+	class Worker : public ofThread
+	{
+	public:
+
+		ThreadPool *pool;
+		int index;
+
+		ofMutex mutex;
+		deque<Task*> tasks;
+
+		Poco::Event wake;
+
+		Worker(ThreadPool *pool, int index) : pool(pool), index(index) {}
+
+		void threadedFunction()
+		{
+			while (isThreadRunning())
+			{
+				if (!pool->runPending(index))
+					wake.wait();
+			}
+		}
+	};
+
+	vector<Worker*> workers;
+
+	ofMutex submit_mutex;
+	int next_queue;
+
+	Task* take(int worker)
+	{
+		// own tasks newest first, they are the ones still in the cache
+		if (worker >= 0)
+		{
+			Worker *w = workers[worker];
+			ofMutex::ScopedLock lock(w->mutex);
+
+			if (!w->tasks.empty())
+			{
+				Task *task = w->tasks.back();
+				w->tasks.pop_back();
+				return task;
+			}
+		}
+
+		// steal the oldest task of the others
+		const int n = workers.size();
+
+		for (int i = 1; i <= n; i++)
+		{
+			Worker *w = workers[(max(worker, 0) + i) % n];
+			if (w->index == worker) continue;
+
+			ofMutex::ScopedLock lock(w->mutex);
+
+			if (!w->tasks.empty())
+			{
+				Task *task = w->tasks.front();
+				w->tasks.pop_front();
+				return task;
+			}
+		}
+
+		return NULL;
+	}
+};
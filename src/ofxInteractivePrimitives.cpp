@@ -2,11 +2,135 @@
 
 using namespace ofxInteractivePrimitives;
 
+// structure of arrays transform store.
+// local, global and inverse matrices of every node live in contiguous arrays
+// ordered by tree depth, so parents always come before their children and
+// the global matrix pass is a single linear sweep.
+
+class ofxInteractivePrimitives::TransformStore
+{
+public:
+	
+	TransformStore() : enabled(false), structure_dirty(true) {}
+	
+	bool isEnabled() const { return enabled; }
+	
+	void setEnabled(RootNode *root, bool v)
+	{
+		if (enabled == v) return;
+		enabled = v;
+		
+		if (enabled)
+			rebuild(root);
+		else
+			detach();
+	}
+	
+	void invalidate() { structure_dirty = true; }
+	
+	void markDirty(int index) { local_dirty[index] = true; }
+	
+	void update(RootNode *root, bool root_changed)
+	{
+		if (!enabled) return;
+		
+		if (structure_dirty)
+		{
+			rebuild(root);
+			root_changed = true;
+		}
+		
+		const ofMatrix4x4 &root_global = root->global_matrix;
+		const size_t n = nodes.size();
+		
+		for (size_t i = 0; i < n; i++)
+		{
+			const int p = parent[i];
+			const bool d = local_dirty[i] || (p < 0 ? root_changed : changed[p]);
+			
+			changed[i] = d;
+			
+			if (!d) continue;
+			
+			local_dirty[i] = false;
+			
+			Node *o = nodes[i];
+			
+			local[i] = o->getLocalTransformMatrix();
+			global[i] = local[i] * (p < 0 ? root_global : global[p]);
+			inverse[i] = global[i].getInverse();
+			
+			// keep the per node cache in sync for the rest of the api
+			o->setGlobalTransform(global[i], inverse[i]);
+			o->transform_dirty = false;
+		}
+	}
+	
+	size_t size() const { return nodes.size(); }
+	
+protected:
+	
+	bool enabled;
+	bool structure_dirty;
+	
+	vector<Node*> nodes;
+	vector<int> parent;
+	vector<ofMatrix4x4> local, global, inverse;
+	vector<char> local_dirty, changed;
+	
+	void rebuild(RootNode *root)
+	{
+		detach();
+		
+		// breadth first, so that the order is by depth
+		for (Node *o = root->first_child; o; o = o->next_sibling)
+			push(o, -1);
+		
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			for (Node *o = nodes[i]->first_child; o; o = o->next_sibling)
+				push(o, i);
+		}
+		
+		const size_t n = nodes.size();
+		local.resize(n);
+		global.resize(n);
+		inverse.resize(n);
+		local_dirty.assign(n, true);
+		changed.assign(n, false);
+		
+		structure_dirty = false;
+	}
+	
+	void push(Node *o, int parent_index)
+	{
+		o->transform_store = this;
+		o->transform_index = nodes.size();
+		
+		nodes.push_back(o);
+		parent.push_back(parent_index);
+	}
+	
+	void detach()
+	{
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			nodes[i]->transform_store = NULL;
+			nodes[i]->transform_index = -1;
+		}
+		
+		nodes.clear();
+		parent.clear();
+		
+		structure_dirty = true;
+	}
+};
+
 class ofxInteractivePrimitives::Context
 {
 public:
 
-	typedef map<unsigned int, Node*> ElemetsContainer;
+	typedef SlotMap<Node> ElemetsContainer;
 	ElemetsContainer elements;
 
 	GLint viewport[4];
@@ -15,40 +139,92 @@ public:
 	ofMatrix4x4 modelViewProjectionMatrix;
 	ofMatrix4x4 modelViewProjectionMatrixInverse;
 
-	unsigned int current_object_id;
 	float current_depth;
 
 	Node *current_object;
 	Node *focus_object;
+	Node *hover_object;
 	
 	vector<GLuint> current_name_stack;
 	
 	float last_update_time;
+	
+	TransformStore transform_store;
+	
+	Backend *backend;
+	
+	RootNode::PickingMode picking_mode;
+	SpatialIndex spatial_index;
+	vector<unsigned int> spatial_candidates;
 
-	Context() : current_object_id(0), current_depth(0), focus_object(NULL), current_object(NULL)
+	RootNode *root;
+	unsigned int update_counter;
+	
+	Profiler profiler;
+	
+	bool draw_culling;
+	unsigned int num_culled;
+	unsigned int num_cache_renders;
+	
+	bool batching;
+	Batch batch;
+	unsigned int num_draw_calls;
+	
+	GLState gl_state;
+	
+	Context(RootNode *root) : current_depth(0), current_object(NULL), focus_object(NULL), hover_object(NULL), backend(new GLBackend), picking_mode(RootNode::PICKING_GL_SELECT), root(root), update_counter(0), draw_culling(true), num_culled(0), num_cache_renders(0), batching(false), num_draw_calls(0), coalesce_events(false)
 	{
+		// preallocate the dispatch path so that steady input does not allocate
+		current_name_stack.reserve(NameStack::CAPACITY);
+		picked_stack.reserve(256);
+		spatial_candidates.reserve(256);
+		pending_events.reserve(64);
+		dispatching_events.reserve(64);
+		
 		enableAllEvent();
 	}
 
 	~Context()
 	{
 		disableAllEvent();
+		
+		delete backend;
+		backend = NULL;
+	}
+	
+	void setBackend(Backend *o)
+	{
+		assert(o);
+		if (o == backend) return;
+		
+		delete backend;
+		backend = o;
 	}
 
 	void registerElement(Node *o)
 	{
 		assert(o->object_id == 0);
 		
-		o->object_id = current_object_id++;
-		elements[o->object_id] = o;
+		o->object_id = elements.insert(o);
+		transform_store.invalidate();
 	}
 
 	void unregisterElement(Node *o)
 	{
 		if (o == current_object) current_object = NULL;
 		if (o == focus_object) focus_object = NULL;
+		if (o == hover_object) hover_object = NULL;
 
 		elements.erase(o->object_id);
+		o->object_id = ElemetsContainer::INVALID_ID;
+		
+		if (o->transform_store)
+		{
+			// not part of the tree anymore
+			o->transform_store = NULL;
+			o->transform_index = -1;
+			transform_store.invalidate();
+		}
 	}
 
 	void enableAllEvent()
@@ -75,127 +251,325 @@ public:
 
 	void prepare()
 	{
-		glGetDoublev(GL_PROJECTION_MATRIX, projection);
-		glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
-		glGetIntegerv(GL_VIEWPORT, viewport);
+		backend->getMatrices(viewport, projection, modelview);
+		
+		float p[16], m[16];
+		for (int i = 0; i < 16; i++)
+		{
+			p[i] = projection[i];
+			m[i] = modelview[i];
+		}
+		
+		modelViewProjectionMatrix = ofMatrix4x4(m) * ofMatrix4x4(p);
+		modelViewProjectionMatrixInverse = modelViewProjectionMatrix.getInverse();
 	}
 	
 	void update()
 	{
 		last_update_time = ofGetElapsedTimef();
+		update_counter = 0;
+		
+		spatial_index.clear();
+	}
+	
+	void updateFinished()
+	{
+		if (isCPUPicking())
+			spatial_index.build();
+	}
+	
+	// backends without GL_SELECT always pick on the CPU
+	bool isCPUPicking() const { return picking_mode == RootNode::PICKING_CPU || !backend->canRender(); }
+	
+	// world -> window coordinates (y down), z is window depth [0, 1]
+	bool project(const ofVec3f& p, ofVec3f& out) const
+	{
+		const float *m = modelViewProjectionMatrix.getPtr();
+		
+		float cx = p.x * m[0] + p.y * m[4] + p.z * m[8] + m[12];
+		float cy = p.x * m[1] + p.y * m[5] + p.z * m[9] + m[13];
+		float cz = p.x * m[2] + p.y * m[6] + p.z * m[10] + m[14];
+		float cw = p.x * m[3] + p.y * m[7] + p.z * m[11] + m[15];
+		
+		// behind the eye
+		if (cw <= 0) return false;
+		
+		out.x = viewport[0] + (cx / cw + 1) * 0.5 * viewport[2];
+		out.y = viewport[3] - (viewport[1] + (cy / cw + 1) * 0.5 * viewport[3]);
+		out.z = (cz / cw + 1) * 0.5;
+		
+		return true;
+	}
+	
+	// window coordinates (y down) -> world
+	ofVec3f unproject(float x, float y, float z) const
+	{
+		float nx = (x - viewport[0]) / viewport[2] * 2 - 1;
+		float ny = ((viewport[3] - y) - viewport[1]) / viewport[3] * 2 - 1;
+		float nz = z * 2 - 1;
+		
+		const float *m = modelViewProjectionMatrixInverse.getPtr();
+		
+		float wx = nx * m[0] + ny * m[4] + nz * m[8] + m[12];
+		float wy = nx * m[1] + ny * m[5] + nz * m[9] + m[13];
+		float wz = nx * m[2] + ny * m[6] + nz * m[10] + m[14];
+		float ww = nx * m[3] + ny * m[7] + nz * m[11] + m[15];
+		
+		if (ww == 0) ww = 1;
+		
+		return ofVec3f(wx / ww, wy / ww, wz / ww);
+	}
+	
+	// screen space rect of world bounds, false when it can not be projected
+	bool projectBounds(const Bounds& b, ofRectangle& r) const
+	{
+		if (!b.valid) return false;
+		
+		float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+		
+		for (int i = 0; i < 8; i++)
+		{
+			ofVec3f w;
+			if (!project(b.getCorner(i), w)) return false;
+			
+			x0 = min(x0, w.x);
+			y0 = min(y0, w.y);
+			x1 = max(x1, w.x);
+			y1 = max(y1, w.y);
+		}
+		
+		r.x = x0;
+		r.y = y0;
+		r.width = x1 - x0;
+		r.height = y1 - y0;
+		
+		return true;
 	}
 	
 	float getLastUpdateTime() { return last_update_time; }
 
 	ofVec3f screenToWorld(const ofVec2f &p)
 	{
-		double x, y, z;
-
-		gluUnProject(p.x, viewport[3] - p.y, current_depth,
-					 modelview, projection, viewport,
-					 &x, &y, &z);
-
-		return ofVec3f(x, y, z);
+		return unproject(p.x, p.y, current_depth);
 	}
 
 	ofVec2f worldToScreen(const ofVec3f &p)
 	{
-		double x, y, z;
-
-		gluProject(p.x, p.y, p.z,
-				   modelview, projection, viewport,
-				   &x, &y, &z);
+		ofVec3f w;
+		if (!project(p, w)) return ofVec2f();
 
-		y = viewport[3] - y;
-
-		return ofVec2f(x, y);
+		return ofVec2f(w.x, w.y);
 	}
 
-	void hittest()
+	static bool intersects(const ofRectangle& a, const ofRectangle& b)
+	{
+		return a.x <= b.x + b.width
+			&& a.x + a.width >= b.x
+			&& a.y <= b.y + b.height
+			&& a.y + a.height >= b.y;
+	}
+	
+	// true when the subtree is entirely outside the viewport captured by prepare()
+	bool cull(const Node *e)
 	{
-		ElemetsContainer::iterator it = elements.begin();
+		if (!draw_culling || !e->subtree_bounded) return false;
+		
+		ofRectangle r;
+		if (!projectBounds(e->subtree_bounds, r)) return false;
+		
+		// same window space as project()
+		const ofRectangle view(viewport[0], -viewport[1], viewport[2], viewport[3]);
+		if (intersects(r, view)) return false;
+		
+		num_culled += e->subtree_size;
+		return true;
+	}
+	
+	// batched draw of a subtree. nodes that can not be batched flush what
+	// was collected before them, so the painter order is kept between runs
+	void drawBatched(Node *e)
+	{
+		if (!e->getVisible() || cull(e)) return;
+		
+		// cached subtrees composite their own target, in painter order
+		if (e->render_cache && backend->canRender())
+		{
+			flushBatch();
+			
+			glPushMatrix();
+			
+			Node *p = e->getParent();
+			if (p) glMultMatrixf(p->global_matrix.getPtr());
+			
+			e->draw(Node::Internal(this));
+			
+			glPopMatrix();
+			return;
+		}
+		
+		batch.begin(e->global_matrix);
+		
+		bool batched;
+		{
+			Profiler::Scope<Node> scope(&profiler, Profiler::DRAW, e, e->object_id);
+			batched = e->drawBatched(batch);
+		}
 		
-		while (it != elements.end())
+		if (!batched && backend->canRender())
 		{
-			Node *e = it->second;
+			flushBatch();
+			
+			glPushMatrix();
+			glMultMatrixf(e->global_matrix.getPtr());
+			{
+				Profiler::Scope<Node> scope(&profiler, Profiler::DRAW, e, e->object_id);
+				e->draw();
+			}
+			glPopMatrix();
 			
-			if (e->getVisible() && e->getEnable())
+			num_draw_calls++;
+		}
+		
+		for (Node *o = e->first_child; o; o = o->next_sibling)
+			drawBatched(o);
+	}
+	
+	void flushBatch(bool clear = true)
+	{
+		num_draw_calls += batch.getNumDrawCalls();
+		
+		if (backend->canRender() && !batch.empty())
+		{
+			// only what the batch changed is put back for the next immediate node
+			gl_state.begin();
+			batch.draw(gl_state);
+			gl_state.restore();
+		}
+		
+		if (clear) batch.clear();
+	}
+	
+	// walk the tree and skip every subtree whose bounds miss the pick region.
+	// only subtrees where every node reported bounds are skipped
+	void hittest(const ofRectangle& region)
+	{
+		for (Node *o = root->first_child; o; o = o->next_sibling)
+			hittest(o, region);
+	}
+	
+	void hittest(Node *e, const ofRectangle& region)
+	{
+		if (!e->getVisible()) return;
+		
+		if (e->subtree_bounded)
+		{
+			ofRectangle r;
+			if (projectBounds(e->subtree_bounds, r)
+				&& !intersects(r, region)) return;
+		}
+		
+		if (e->getEnable())
+		{
+			glPushMatrix();
+			glMultMatrixf(e->global_matrix.getPtr());
+			glPushName(e->object_id);
 			{
-				e->transformGL();
-				glPushName(e->object_id);
+				Profiler::Scope<Node> scope(&profiler, Profiler::HITTEST, e, e->object_id);
 				e->hittest();
-				glPopName();
-				e->restoreTransformGL();
 			}
-
-			it++;
+			glPopName();
+			glPopMatrix();
 		}
+		
+		for (Node *o = e->first_child; o; o = o->next_sibling)
+			hittest(o, region);
 	}
 
+	// fixed capacity name stack, copying a selection never allocates
+	struct NameStack
+	{
+		enum { CAPACITY = 32 };
+		
+		GLuint names[CAPACITY];
+		int num_names;
+		
+		NameStack() : num_names(0) {}
+		
+		void clear() { num_names = 0; }
+		
+		void push_back(GLuint v)
+		{
+			assert(num_names < CAPACITY);
+			if (num_names < CAPACITY) names[num_names++] = v;
+		}
+		
+		template <typename Iterator>
+		void append(Iterator first, Iterator last)
+		{
+			while (first != last) push_back(*first++);
+		}
+		
+		size_t size() const { return num_names; }
+		GLuint at(int i) const { assert(i < num_names); return names[i]; }
+		
+		const GLuint* begin() const { return names; }
+		const GLuint* end() const { return names + num_names; }
+	};
+	
+	struct HittestCallback : public Backend::SelectCallback
+	{
+		Context &context;
+		ofRectangle region;
+		
+		HittestCallback(Context &context, const ofRectangle &region) : context(context), region(region) {}
+		void operator()() { context.hittest(region); }
+	};
+	
 	struct Selection
 	{
 		GLuint min_depth, max_depth;
-		vector<GLuint> name_stack;
+		NameStack name_stack;
+		
+		// emission order, keeps equal depth hits in the order they were issued
+		int order;
 	};
 
 	static bool sort_by_depth(const Selection &a, const Selection &b)
 	{
-		return a.min_depth < b.min_depth;
+		if (a.min_depth != b.min_depth)
+			return a.min_depth < b.min_depth;
+		
+		return a.order < b.order;
 	}
 
-	vector<Selection> pickup(int x, int y)
+	// reused by every pick, results are valid until the next pickup()
+	vector<Selection> picked_stack;
+	
+	const vector<Selection>& pickup(int x, int y)
 	{
+		Profiler::Scope<Node> scope(&profiler, Profiler::PICKUP);
+		
+		picked_stack.clear();
+		
 		// hittest timeout
 		if (ofGetElapsedTimef() - last_update_time > 0.1)
 		{
-			return vector<Selection>();
+			return picked_stack;
 		}
 		
+		if (isCPUPicking())
+			return pickupCPU(x, y);
+		
 		const int BUFSIZE = 256;
 		GLuint selectBuf[BUFSIZE];
-		GLint hits;
-
-		glPushAttrib(GL_ALL_ATTRIB_BITS);
-		ofPushStyle();
-		ofPushView();
-
-		glEnable(GL_DEPTH_TEST);
-		ofFill();
-
-		glSelectBuffer(BUFSIZE, selectBuf);
-		glRenderMode(GL_SELECT);
-		glMatrixMode(GL_PROJECTION);
-
-		glPushMatrix();
-		{
-			glLoadIdentity();
-			gluPickMatrix(x, viewport[3] - y, 5.0, 5.0, viewport);
-			glMultMatrixd(projection);
-
-			glMatrixMode(GL_MODELVIEW);
-			glLoadIdentity();
-			glMultMatrixd(modelview);
-
-			hittest();
-
-			glMatrixMode(GL_PROJECTION);
-		}
-		glPopMatrix();
-
-		glMatrixMode(GL_MODELVIEW);
-
-		hits = glRenderMode(GL_RENDER);
-
-		ofPopView();
-		ofPopStyle();
-		glPopAttrib();
+		
+		HittestCallback callback(*this, ofRectangle(x - 2.5, y - 2.5, 5, 5));
+		GLint hits = backend->select(x, y, viewport, projection, modelview, selectBuf, BUFSIZE, callback, gl_state);
 
-		if (hits <= 0) return vector<Selection>();
+		if (hits <= 0) return picked_stack;
 
 		GLuint *ptr = selectBuf;
 
-		vector<Selection> picked_stack;
-
 		for (int i = 0; i < hits; i++)
 		{
 			GLuint num_names = ptr[0];
@@ -204,13 +578,13 @@ public:
 
 			GLuint *names = &ptr[3];
 
-			Selection d;
+			picked_stack.push_back(Selection());
+			Selection &d = picked_stack.back();
 
 			d.min_depth = min_depth;
 			d.max_depth = max_depth;
-			d.name_stack.insert(d.name_stack.begin(), names, (names + num_names));
-
-			picked_stack.push_back(d);
+			d.name_stack.append(names, names + num_names);
+			d.order = i;
 
 			ptr += (3 + num_names);
 		}
@@ -219,154 +593,481 @@ public:
 
 		return picked_stack;
 	}
-
-	ofVec3f getLocalPosition(int x, int y)
-	{
-		GLdouble ox, oy, oz;
-
-		gluUnProject(x, y, current_depth,
-					 modelview, projection, viewport,
-					 &ox, &oy, &oz);
-
-		oy = viewport[3] - oy;
-
-		return ofVec2f(ox, oy);
-	}
-
-	// event callbacks
-
-	void mousePressed(ofMouseEventArgs &e)
+	
+	// CPU picking: the same 5x5 pick region as gluPickMatrix, tested against the
+	// spatial index built from the hit shapes recorded during update.
+	
+	struct PickRegionTest
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
+		const Context &context;
+		ofRectangle region;
+		
+		PickRegionTest(const Context &context, const ofRectangle &region) : context(context), region(region) {}
+		
+		bool operator()(const Bounds& b) const
 		{
-			it->second->clearState();
-			it++;
+			ofRectangle r;
+			
+			// can not be projected (crossing the eye plane), keep it as a candidate
+			if (!context.projectBounds(b, r)) return true;
+			
+			return intersects(r, region);
 		}
-
-		vector<Selection> p = pickup(e.x, e.y);
-
-		if (!p.empty())
+	};
+	
+	static float distanceToSegment(const ofVec2f& p, const ofVec2f& a, const ofVec2f& b)
+	{
+		ofVec2f ab = b - a;
+		float len2 = ab.lengthSquared();
+		if (len2 == 0) return (p - a).length();
+		
+		float t = ofClamp((p - a).dot(ab) / len2, 0, 1);
+		return (p - (a + ab * t)).length();
+	}
+	
+	static bool testHitShape(const Node *o, const Node::HitShape &shape, const ofVec2f &p, float tolerance)
+	{
+		const ofVec2f *pts = &o->hit_points[shape.point_offset];
+		
+		switch (shape.type)
 		{
-			Selection &s = p[0];
-			current_depth = (float)s.min_depth / 0xffffffff;
+			case Node::HitShape::RECT:
+			{
+				return p.x >= pts[0].x - tolerance && p.x <= pts[1].x + tolerance
+					&& p.y >= pts[0].y - tolerance && p.y <= pts[1].y + tolerance;
+			}
 			
-			if (s.name_stack.size())
+			case Node::HitShape::CIRCLE:
+			{
+				return (p - pts[0]).length() <= shape.radius + tolerance;
+			}
+			
+			case Node::HitShape::SEGMENT:
+			{
+				return distanceToSegment(p, pts[0], pts[1]) <= shape.radius + tolerance;
+			}
+			
+			case Node::HitShape::POLYGON:
 			{
-				GLuint oid = s.name_stack.at(0);
+				// even-odd rule
+				bool inside = false;
 				
-				current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
+				for (int i = 0, j = shape.num_points - 1; i < shape.num_points; j = i++)
+				{
+					const ofVec2f &a = pts[i];
+					const ofVec2f &b = pts[j];
+					
+					if (((a.y > p.y) != (b.y > p.y))
+						&& (p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x))
+						inside = !inside;
+				}
 				
-				ElemetsContainer::iterator it = elements.find(oid);
-				if (it == elements.end()) goto __end__;
-
-				Node *w = it->second;
-				if (w == NULL) goto __end__;
-
-				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
-
-				w->hover = true;
-				w->down = true;
-
-				current_object = w;
-
-				focusWillLost(focus_object);
-				focus_object = w;
+				if (inside) return true;
 				
-				w->mousePressed(p.x, p.y, e.button);
+				for (int i = 0, j = shape.num_points - 1; i < shape.num_points; j = i++)
+				{
+					if (distanceToSegment(p, pts[i], pts[j]) <= tolerance)
+						return true;
+				}
+				
+				return false;
 			}
-			
-			__end__:;
 		}
-		else
-		{
-			current_object = NULL;
-
-			focusWillLost(focus_object);
-			focus_object = NULL;
-			
-			current_name_stack.clear();
+		
+		return false;
+	}
+	
+	// intersect a world space ray with the local z = 0 plane of the node
+	static bool intersectLocalPlane(const Node *o, const ofVec3f& near, const ofVec3f& far, ofVec2f& out)
+	{
+		ofVec3f n = o->global_matrix_inverse.preMult(near);
+		ofVec3f f = o->global_matrix_inverse.preMult(far);
+		ofVec3f d = f - n;
+		
+		if (fabs(d.z) < 1e-9) return false;
+		
+		float t = -n.z / d.z;
+		out.x = n.x + d.x * t;
+		out.y = n.y + d.y * t;
+		
+		return true;
+	}
+	
+	const vector<Selection>& pickupCPU(int x, int y)
+	{
+		const float PICK_SIZE = 5.0;
+		
+		PickRegionTest test(*this, ofRectangle(x - PICK_SIZE * 0.5, y - PICK_SIZE * 0.5, PICK_SIZE, PICK_SIZE));
+		
+		spatial_candidates.clear();
+		spatial_index.query(test, spatial_candidates);
+		
+		if (spatial_candidates.empty()) return picked_stack;
+		
+		ofVec3f near = unproject(x, y, 0);
+		ofVec3f far = unproject(x, y, 1);
+		
+		// half of the pick region, measured in local units of each node
+		ofVec3f near_edge = unproject(x + PICK_SIZE * 0.5, y, 0);
+		ofVec3f far_edge = unproject(x + PICK_SIZE * 0.5, y, 1);
+		
+		for (size_t i = 0; i < spatial_candidates.size(); i++)
+		{
+			Node *o = elements.find(spatial_candidates[i]);
+			if (o == NULL) continue;
+			
+			ofVec2f p, edge;
+			if (!intersectLocalPlane(o, near, far, p)) continue;
+			if (!intersectLocalPlane(o, near_edge, far_edge, edge)) continue;
+			
+			float tolerance = (edge - p).length();
+			
+			for (size_t n = 0; n < o->hit_shapes.size(); n++)
+			{
+				const Node::HitShape &shape = o->hit_shapes[n];
+				
+				if (!testHitShape(o, shape, p, tolerance)) continue;
+				
+				ofVec3f w;
+				if (!project(o->global_matrix.preMult(ofVec3f(p.x, p.y, 0)), w)) continue;
+				
+				picked_stack.push_back(Selection());
+				Selection &d = picked_stack.back();
+				
+				d.min_depth = d.max_depth = (GLuint)(ofClamp(w.z, 0, 1) * 4294967295.0);
+				d.name_stack.push_back(o->object_id);
+				d.name_stack.append(o->hit_names.begin() + shape.name_offset,
+									o->hit_names.begin() + shape.name_offset + shape.num_names);
+				
+				// same order as the GL path which issues nodes in tree order
+				d.order = o->update_order * 1024 + n;
+			}
 		}
+		
+		sort(picked_stack.begin(), picked_stack.end(), sort_by_depth);
+		
+		return picked_stack;
+	}
 
-		if (focus_object)
-			focus_object->focus = true;
+	ofVec3f getLocalPosition(int x, int y)
+	{
+		// same as gluUnProject of the unflipped window position
+		ofVec3f o = unproject(x, viewport[3] - y, current_depth);
+
+		o.y = viewport[3] - o.y;
+
+		return ofVec2f(o.x, o.y);
 	}
 
-	void mouseReleased(ofMouseEventArgs &e)
+	// event callbacks
+	
+	// with coalescing enabled, events are queued and dispatched once per frame
+	// from RootNode::update(). consecutive moves, and drags with the same button,
+	// collapse to the latest position. presses, releases and keys keep their order.
+	
+	struct PendingEvent
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
+		enum Type
 		{
-			it->second->clearState();
-			it++;
+			MOUSE_PRESSED,
+			MOUSE_RELEASED,
+			MOUSE_MOVED,
+			MOUSE_DRAGGED,
+			KEY_PRESSED,
+			KEY_RELEASED
+		};
+		
+		Type type;
+		ofMouseEventArgs mouse;
+		ofKeyEventArgs key;
+	};
+	
+	bool coalesce_events;
+	vector<PendingEvent> pending_events, dispatching_events;
+	
+	// position of the event being dispatched, relative to the previous one
+	ofVec2f mouse_position, mouse_delta;
+	
+	void trackMouse(const ofMouseEventArgs &e, bool reset)
+	{
+		ofVec2f p(e.x, e.y);
+		mouse_delta = reset ? ofVec2f(0, 0) : p - mouse_position;
+		mouse_position = p;
+	}
+	
+	void queueMouseEvent(PendingEvent::Type type, const ofMouseEventArgs &e)
+	{
+		if ((type == PendingEvent::MOUSE_MOVED || type == PendingEvent::MOUSE_DRAGGED)
+			&& !pending_events.empty())
+		{
+			PendingEvent &last = pending_events.back();
+			
+			if (last.type == type
+				&& (type == PendingEvent::MOUSE_MOVED || last.mouse.button == e.button))
+			{
+				last.mouse = e;
+				return;
+			}
+		}
+		
+		PendingEvent o;
+		o.type = type;
+		o.mouse = e;
+		pending_events.push_back(o);
+	}
+	
+	void queueKeyEvent(PendingEvent::Type type, const ofKeyEventArgs &e)
+	{
+		PendingEvent o;
+		o.type = type;
+		o.key = e;
+		pending_events.push_back(o);
+	}
+	
+	void flushEvents()
+	{
+		if (pending_events.empty()) return;
+		
+		// handlers may cause new events, dispatch from a separate buffer
+		dispatching_events.swap(pending_events);
+		
+		for (size_t i = 0; i < dispatching_events.size(); i++)
+		{
+			PendingEvent &o = dispatching_events[i];
+			
+			switch (o.type)
+			{
+				case PendingEvent::MOUSE_PRESSED: dispatchMousePressed(o.mouse); break;
+				case PendingEvent::MOUSE_RELEASED: dispatchMouseReleased(o.mouse); break;
+				case PendingEvent::MOUSE_MOVED: dispatchMouseMoved(o.mouse); break;
+				case PendingEvent::MOUSE_DRAGGED: dispatchMouseDragged(o.mouse); break;
+				case PendingEvent::KEY_PRESSED: dispatchKeyPressed(o.key); break;
+				case PendingEvent::KEY_RELEASED: dispatchKeyReleased(o.key); break;
+			}
 		}
+		
+		dispatching_events.clear();
+	}
+	
+	void setEventCoalescing(bool v)
+	{
+		if (coalesce_events && !v) flushEvents();
+		coalesce_events = v;
+	}
+	
+	void mousePressed(ofMouseEventArgs &e)
+	{
+		if (coalesce_events) queueMouseEvent(PendingEvent::MOUSE_PRESSED, e);
+		else dispatchMousePressed(e);
+	}
+	
+	void mouseReleased(ofMouseEventArgs &e)
+	{
+		if (coalesce_events) queueMouseEvent(PendingEvent::MOUSE_RELEASED, e);
+		else dispatchMouseReleased(e);
+	}
+	
+	void mouseMoved(ofMouseEventArgs &e)
+	{
+		if (coalesce_events) queueMouseEvent(PendingEvent::MOUSE_MOVED, e);
+		else dispatchMouseMoved(e);
+	}
+	
+	void mouseDragged(ofMouseEventArgs &e)
+	{
+		if (coalesce_events) queueMouseEvent(PendingEvent::MOUSE_DRAGGED, e);
+		else dispatchMouseDragged(e);
+	}
+	
+	void keyPressed(ofKeyEventArgs &e)
+	{
+		if (coalesce_events) queueKeyEvent(PendingEvent::KEY_PRESSED, e);
+		else dispatchKeyPressed(e);
+	}
+	
+	void keyReleased(ofKeyEventArgs &e)
+	{
+		if (coalesce_events) queueKeyEvent(PendingEvent::KEY_RELEASED, e);
+		else dispatchKeyReleased(e);
+	}
 
+	// hover / focus state is tracked here and only the nodes whose state
+	// changes are touched, so dispatch does not depend on the number of nodes
+	
+	void setHoverObject(Node *o)
+	{
+		if (o == hover_object) return;
+		
+		Node *prev = hover_object;
+		hover_object = o;
+		
+		if (prev)
+		{
+			prev->hover = false;
+			prev->markRenderDirty();
+			prev->mouseExited();
+		}
+		
+		if (o)
+		{
+			o->hover = true;
+			o->markRenderDirty();
+			o->mouseEntered();
+		}
+	}
+	
+	void setFocusObject(Node *o)
+	{
+		if (o == focus_object) return;
+		
+		if (focus_object)
+		{
+			focus_object->focus = false;
+			focus_object->markRenderDirty();
+		}
+		
+		focus_object = o;
+		
 		if (focus_object)
+		{
 			focus_object->focus = true;
-
-		vector<Selection> p = pickup(e.x, e.y);
+			focus_object->markRenderDirty();
+		}
+	}
+	
+	// ids from an earlier pick may be stale, the slot map rejects them
+	Node* findElement(GLuint oid)
+	{
+		return elements.find(oid);
+	}
+	
+	void dispatchMousePressed(ofMouseEventArgs &e)
+	{
+		trackMouse(e, true);
+		
+		const vector<Selection> &p = pickup(e.x, e.y);
 
 		if (!p.empty())
 		{
-			Selection &s = p[0];
+			const Selection &s = p[0];
 			current_depth = (float)s.min_depth / 0xffffffff;
-
-			if (s.name_stack.size())
+			
+			Node *w = s.name_stack.size() ? findElement(s.name_stack.at(0)) : NULL;
+			
+			if (w)
 			{
-				Node *w = elements[s.name_stack.at(0)];
+				current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
+				
 				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
+				p = w->globalToLocalPos(p);
 
-				w->hover = true;
-				w->mouseReleased(p.x, p.y, e.button);
+				setHoverObject(w);
+				w->down = true;
+				w->markRenderDirty();
+
+				current_object = w;
+
+				focusWillLost(focus_object);
+				setFocusObject(w);
+				
+				w->mousePressed(p.x, p.y, e.button);
+			}
+			else
+			{
+				if (s.name_stack.size())
+					current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
+				
+				setHoverObject(NULL);
 			}
 		}
+		else
+		{
+			setHoverObject(NULL);
+			
+			current_object = NULL;
+
+			focusWillLost(focus_object);
+			setFocusObject(NULL);
+			
+			current_name_stack.clear();
+		}
+	}
+
+	void dispatchMouseReleased(ofMouseEventArgs &e)
+	{
+		trackMouse(e, false);
+		
+		const vector<Selection> &p = pickup(e.x, e.y);
+		
+		Node *w = NULL;
+
+		if (!p.empty())
+		{
+			const Selection &s = p[0];
+			current_depth = (float)s.min_depth / 0xffffffff;
+
+			if (s.name_stack.size())
+				w = findElement(s.name_stack.at(0));
+		}
+		
+		setHoverObject(w);
+		
+		if (w)
+		{
+			ofVec3f p = getLocalPosition(e.x, e.y);
+			p = w->globalToLocalPos(p);
+			
+			w->mouseReleased(p.x, p.y, e.button);
+		}
 
 		current_name_stack.clear();
 		
 		if (current_object)
 		{
 			ofVec3f p = getLocalPosition(e.x, e.y);
-			p = current_object->getGlobalTransformMatrix().getInverse().preMult(p);
+			p = current_object->globalToLocalPos(p);
 
 			current_object->mouseReleased(p.x, p.y, e.button);
 			current_object->down = false;
+			current_object->markRenderDirty();
 			current_object = NULL;
 		}
 	}
 
-	void mouseMoved(ofMouseEventArgs &e)
+	void dispatchMouseMoved(ofMouseEventArgs &e)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
-
-		if (focus_object)
-			focus_object->focus = true;
-
-		vector<Selection> p = pickup(e.x, e.y);
+		trackMouse(e, false);
+		
+		const vector<Selection> &p = pickup(e.x, e.y);
+		
+		Node *w = NULL;
 
 		if (!p.empty())
 		{
-			Selection &s = p[0];
+			const Selection &s = p[0];
 			current_depth = (float)s.min_depth / 0xffffffff;
 
 			if (s.name_stack.size())
-			{
-				Node *w = elements[s.name_stack.at(0)];
-				
-				current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
+				w = findElement(s.name_stack.at(0));
+		}
+		
+		setHoverObject(w);
+		
+		if (w)
+		{
+			const Selection &s = p[0];
+			
+			// hovering another part of the same node, e.g. a patcher port
+			if (current_name_stack.size() != s.name_stack.size() - 1
+				|| !equal(current_name_stack.begin(), current_name_stack.end(), s.name_stack.begin() + 1))
+				w->markRenderDirty();
+			
+			current_name_stack.assign(s.name_stack.begin() + 1, s.name_stack.end());
 
-				ofVec3f p = getLocalPosition(e.x, e.y);
-				p = w->getGlobalTransformMatrix().getInverse().preMult(p);
+			ofVec3f p = getLocalPosition(e.x, e.y);
+			p = w->globalToLocalPos(p);
 
-				w->hover = true;
-				w->mouseMoved(p.x, p.y);
-			}
+			w->mouseMoved(p.x, p.y);
 		}
 		else
 		{
@@ -376,36 +1077,30 @@ public:
 		if (current_object)
 		{
 			current_object->down = false;
+			current_object->markRenderDirty();
 			current_object = NULL;
 			
 			current_name_stack.clear();
 		}
 	}
 
-	void mouseDragged(ofMouseEventArgs &e)
+	void dispatchMouseDragged(ofMouseEventArgs &e)
 	{
-		ElemetsContainer::iterator it = elements.begin();
-		while (it != elements.end())
-		{
-			it->second->clearState();
-			it++;
-		}
-
-		if (focus_object)
-			focus_object->focus = true;
-
+		trackMouse(e, false);
+		
+		setHoverObject(current_object);
+		
 		if (current_object)
 		{
 			ofVec3f p = getLocalPosition(e.x, e.y);
-			p = current_object->getGlobalTransformMatrix().getInverse().preMult(p);
+			p = current_object->globalToLocalPos(p);
 
-			current_object->hover = true;
 			current_object->mouseDragged(p.x, p.y, e.button);
 		}
 	}
 
 	map<int, bool> current_focus_key;
-	void keyPressed(ofKeyEventArgs &e)
+	void dispatchKeyPressed(ofKeyEventArgs &e)
 	{
 		if (focus_object)
 		{
@@ -414,7 +1109,7 @@ public:
 		}
 	}
 
-	void keyReleased(ofKeyEventArgs &e)
+	void dispatchKeyReleased(ofKeyEventArgs &e)
 	{
 		if (focus_object)
 		{
@@ -425,6 +1120,8 @@ public:
 
 	void focusWillLost(Node *p)
 	{
+		if (p == NULL) return;
+		
 		// cleanup keys
 
 		map<int, bool>::iterator it = current_focus_key.begin();
@@ -445,17 +1142,12 @@ public:
 	{
 		assert(o);
 		current_object = o;
-		focus_object = o;
-		focus_object->focus = true;
+		setFocusObject(o);
 	}
 	
 	void clearFocus()
 	{
-		if (focus_object)
-		{
-			focus_object->focus = false;
-			focus_object= NULL;
-		}
+		setFocusObject(NULL);
 		
 		if (current_object)
 		{
@@ -466,12 +1158,14 @@ public:
 	}
 };
 
-Node::Node() : object_id(0), hover(false), down(false), visible(true), focus(false), enable(true)
+Node::Node() : object_id(0), hover(false), down(false), visible(true), focus(false), enable(true), transform_dirty(true), affine_2d(false), global_is_2d(false), transform_store(NULL), transform_index(-1), render_cache(NULL), first_child(NULL), last_child(NULL), prev_sibling(NULL), next_sibling(NULL), num_children(0), subtree_bounded(false), subtree_size(1), update_order(0), hit_recording(false)
 {
 }
 
 Node::~Node()
 {
+	delete render_cache;
+	render_cache = NULL;
 }
 
 void Node::dispose()
@@ -483,6 +1177,9 @@ void Node::dispose()
 
 ofVec2f Node::getMouseDelta()
 {
+	Context *context = getContext();
+	if (context) return context->mouse_delta;
+	
 	return ofVec2f(ofGetMouseX() - ofGetPreviousMouseX(), ofGetMouseY() - ofGetPreviousMouseY());
 }
 	
@@ -493,11 +1190,17 @@ const vector<GLuint>& Node::getCurrentNameStack()
 
 ofVec3f Node::localToGlobalPos(const ofVec3f& v)
 {
+	refreshGlobalTransform();
+	
+	if (global_is_2d) return global_affine.preMult(v);
 	return global_matrix.preMult(v);
 }
 
 ofVec3f Node::globalToLocalPos(const ofVec3f& v)
 {
+	refreshGlobalTransform();
+	
+	if (global_is_2d) return global_affine_inverse.preMult(v);
 	return global_matrix_inverse.preMult(v);
 }
 
@@ -513,93 +1216,580 @@ ofVec2f Node::worldToScreen(const ofVec3f& v)
 
 void Node::setParent(Node *o)
 {
-	if (getParent())
-		clearParent();
+	assert(o);
+	
+	Node *p = getParent();
+	if (p == o) return;
+	
+	Context *from = p ? getContext() : NULL;
+	Context *to = o->getContext();
+	
+	if (p)
+	{
+		// moving inside one context keeps the object id
+		if (from && from != to) from->unregisterElement(this);
+		
+		p->invalidateSubtreeBounds();
+		p->unlinkChild(this);
+		ofNode::clearParent();
+	}
 
 	ofNode::setParent(*o);
-	o->children.push_back(this);
+	o->linkChild(this);
+	
+	transform_dirty = true;
+	
+	o->invalidateSubtreeBounds();
 
-	getContext()->registerElement(this);
+	if (to)
+	{
+		if (from != to || object_id == 0)
+			to->registerElement(this);
+		else
+			to->transform_store.invalidate();
+	}
 }
 
 void Node::clearParent()
 {
-	getContext()->unregisterElement(this);
-	
 	Node *p = getParent();
-	if (p)
-	{
-		vector<Node*> &p_children = p->children;
-		vector<Node*>::iterator it;
-
-		it = remove(p_children.begin(), p_children.end(), this);
-		p_children.erase(it, p_children.end());
-	}
+	if (p == NULL) return;
+	
+	Context *context = getContext();
+	if (context) context->unregisterElement(this);
+	
+	p->invalidateSubtreeBounds();
+	p->unlinkChild(this);
 
 	ofNode::clearParent();
+	
+	transform_dirty = true;
 }
 
-void Node::clearState()
-{
-	hover = false;
-	focus = false;
-}
-
-Context* Node::getContext()
+vector<Node*> Node::getChildren()
 {
-	Node *p = getParent();
-	if (p) return p->getContext();
-	else return NULL;
+	vector<Node*> result;
+	result.reserve(num_children);
+	
+	for (Node *o = first_child; o; o = o->next_sibling)
+		result.push_back(o);
+	
+	return result;
 }
 
-void Node::draw(const Internal &)
+void Node::moveChildrenTo(Node *new_parent)
 {
-	static Internal intn;
-
-	if (getVisible())
+	assert(new_parent);
+	if (new_parent == this || first_child == NULL) return;
+	
+	Context *from = getContext();
+	Context *to = new_parent->getContext();
+	
+	invalidateSubtreeBounds();
+	new_parent->invalidateSubtreeBounds();
+	
+	markRenderDirty();
+	new_parent->markRenderDirty();
+	
+	for (Node *o = first_child; o; o = o->next_sibling)
 	{
-		glPushMatrix();
+		assert(o != new_parent);
+		
+		o->ofNode::setParent(*new_parent);
+		o->transform_dirty = true;
+		
+		if (from != to)
+		{
+			if (from) from->unregisterElement(o);
+			if (to) to->registerElement(o);
+		}
+	}
+	
+	// splice the whole list
+	if (new_parent->last_child)
+	{
+		new_parent->last_child->next_sibling = first_child;
+		first_child->prev_sibling = new_parent->last_child;
+	}
+	else
+	{
+		new_parent->first_child = first_child;
+	}
+	
+	new_parent->last_child = last_child;
+	new_parent->num_children += num_children;
+	
+	first_child = last_child = NULL;
+	num_children = 0;
+	
+	if (from == to && to) to->transform_store.invalidate();
+}
+
+void Node::detachChildren()
+{
+	if (first_child == NULL) return;
+	
+	Context *context = getContext();
+	
+	invalidateSubtreeBounds();
+	markRenderDirty();
+	
+	Node *o = first_child;
+	while (o)
+	{
+		Node *next = o->next_sibling;
+		
+		if (context) context->unregisterElement(o);
+		
+		o->prev_sibling = o->next_sibling = NULL;
+		o->ofNode::clearParent();
+		o->transform_dirty = true;
+		
+		o = next;
+	}
+	
+	first_child = last_child = NULL;
+	num_children = 0;
+}
+
+void Node::linkChild(Node *o)
+{
+	markRenderDirty();
+	
+	o->prev_sibling = last_child;
+	o->next_sibling = NULL;
+	
+	if (last_child)
+		last_child->next_sibling = o;
+	else
+		first_child = o;
+	
+	last_child = o;
+	num_children++;
+}
+
+void Node::unlinkChild(Node *o)
+{
+	markRenderDirty();
+	
+	if (o->prev_sibling)
+		o->prev_sibling->next_sibling = o->next_sibling;
+	else
+		first_child = o->next_sibling;
+	
+	if (o->next_sibling)
+		o->next_sibling->prev_sibling = o->prev_sibling;
+	else
+		last_child = o->prev_sibling;
+	
+	o->prev_sibling = o->next_sibling = NULL;
+	num_children--;
+}
+
+void Node::pushID(int id)
+{
+	if (hit_recording)
+		hit_name_stack.push_back(id);
+	else
+		glPushName(id);
+}
+
+void Node::popID()
+{
+	if (hit_recording)
+	{
+		if (!hit_name_stack.empty())
+			hit_name_stack.pop_back();
+	}
+	else
+	{
+		glPopName();
+	}
+}
+
+void Node::hitRect(const ofRectangle& r)
+{
+	if (!hit_recording)
+	{
+		ofRect(r);
+		return;
+	}
+	
+	float x0 = min(r.x, r.x + r.width);
+	float y0 = min(r.y, r.y + r.height);
+	float x1 = max(r.x, r.x + r.width);
+	float y1 = max(r.y, r.y + r.height);
+	
+	beginHitShape(HitShape::RECT, 0);
+	addHitPoint(ofVec2f(x0, y0));
+	addHitPoint(ofVec2f(x1, y1));
+}
+
+void Node::hitCircle(float x, float y, float radius)
+{
+	if (!hit_recording)
+	{
+		ofCircle(x, y, radius);
+		return;
+	}
+	
+	beginHitShape(HitShape::CIRCLE, radius);
+	addHitPoint(ofVec2f(x, y));
+}
+
+void Node::hitLine(const ofVec3f& p0, const ofVec3f& p1, float width)
+{
+	if (!hit_recording)
+	{
+		ofSetLineWidth(width);
+		ofLine(p0, p1);
+		return;
+	}
+	
+	beginHitShape(HitShape::SEGMENT, width * 0.5);
+	addHitPoint(p0);
+	addHitPoint(p1);
+}
+
+void Node::hitPolygon(const vector<ofVec2f>& points)
+{
+	if (!hit_recording)
+	{
+		ofBeginShape();
+		for (size_t i = 0; i < points.size(); i++)
+			ofVertex(points[i].x, points[i].y);
+		ofEndShape(true);
+		return;
+	}
+	
+	if (points.size() < 3) return;
+	
+	beginHitShape(HitShape::POLYGON, 0);
+	for (size_t i = 0; i < points.size(); i++)
+		addHitPoint(points[i]);
+}
+
+void Node::beginHitShape(HitShape::Type type, float radius)
+{
+	HitShape shape;
+	shape.type = type;
+	shape.radius = radius;
+	shape.point_offset = hit_points.size();
+	shape.num_points = 0;
+	shape.name_offset = hit_names.size();
+	shape.num_names = hit_name_stack.size();
+	
+	hit_names.insert(hit_names.end(), hit_name_stack.begin(), hit_name_stack.end());
+	hit_shapes.push_back(shape);
+}
+
+void Node::addHitPoint(const ofVec2f& p)
+{
+	HitShape &shape = hit_shapes.back();
+	
+	float r = shape.radius;
+	
+	if (hit_shapes.size() == 1 && shape.num_points == 0)
+	{
+		hit_rect = ofRectangle(p.x - r, p.y - r, r * 2, r * 2);
+	}
+	else
+	{
+		float x0 = min(hit_rect.x, p.x - r);
+		float y0 = min(hit_rect.y, p.y - r);
+		float x1 = max(hit_rect.x + hit_rect.width, p.x + r);
+		float y1 = max(hit_rect.y + hit_rect.height, p.y + r);
+		
+		hit_rect = ofRectangle(x0, y0, x1 - x0, y1 - y0);
+	}
+	
+	hit_points.push_back(p);
+	shape.num_points++;
+}
+
+void Node::recordHitShapes()
+{
+	hit_shapes.clear();
+	hit_points.clear();
+	hit_names.clear();
+	hit_name_stack.clear();
+	
+	hit_recording = true;
+	hittest();
+	hit_recording = false;
+}
+
+void Node::invalidateSubtreeBounds()
+{
+	// until the next update the parents can not be culled
+	Node *p = this;
+	while (p && p->subtree_bounded)
+	{
+		p->subtree_bounded = false;
+		p = p->getParent();
+	}
+}
+
+void Node::clearState()
+{
+	if (hover || focus) markRenderDirty();
+	
+	hover = false;
+	focus = false;
+}
+
+Context* Node::getContext()
+{
+	Node *p = getParent();
+	if (p) return p->getContext();
+	else return NULL;
+}
+
+void Node::draw(const Internal &intn)
+{
+	if (getVisible())
+	{
+		// a cache covers its whole subtree, on screen or not
+		if (!intn.caching && intn.context && intn.context->cull(this)) return;
+		
+		glPushMatrix();
 		glMultMatrixf(getLocalTransformMatrix().getPtr());
 
+		if (render_cache && intn.context && intn.context->backend->canRender())
+			drawCached(intn);
+		else
+			drawContents(intn);
+
+		glPopMatrix();
+	}
+}
+
+void Node::drawContents(const Internal &intn)
+{
+	{
+		Profiler::Scope<Node> scope(intn.context ? &intn.context->profiler : NULL, Profiler::DRAW, this, object_id);
 		draw();
+	}
+	
+	if (intn.context) intn.context->num_draw_calls++;
 
-		for (int i = 0; i < children.size(); i++)
-		{
-			if (children[i]->getVisible())
-				children[i]->draw(intn);
-		}
+	for (Node *o = first_child; o; o = o->next_sibling)
+	{
+		if (o->getVisible())
+			o->draw(intn);
+	}
+}
 
+void Node::drawCached(const Internal &intn)
+{
+	if (!subtree_bounded || !subtree_bounds.valid)
+	{
+		drawContents(intn);
+		return;
+	}
+	
+	// local space rect of the subtree
+	float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+	
+	for (int i = 0; i < 8; i++)
+	{
+		ofVec3f p = global_matrix_inverse.preMult(subtree_bounds.getCorner(i));
+		
+		x0 = min(x0, p.x);
+		y0 = min(y0, p.y);
+		x1 = max(x1, p.x);
+		y1 = max(y1, p.y);
+	}
+	
+	// one pixel border for line widths and rounding
+	const ofRectangle r(floor(x0) - 1, floor(y0) - 1, ceil(x1) - floor(x0) + 2, ceil(y1) - floor(y0) + 2);
+	
+	RenderCache &c = *render_cache;
+	
+	if (r.x != c.rect.x || r.y != c.rect.y || r.width != c.rect.width || r.height != c.rect.height)
+		c.dirty = true;
+	
+	if (c.dirty)
+	{
+		if (!c.fbo.isAllocated() || c.fbo.getWidth() != r.width || c.fbo.getHeight() != r.height)
+			c.fbo.allocate(r.width, r.height, GL_RGBA);
+		
+		c.fbo.begin();
+		ofClear(0, 0, 0, 0);
+		
+		ofPushStyle();
+		glPushMatrix();
+		glTranslatef(-r.x, -r.y, 0);
+		
+		drawContents(Internal(intn.context, true));
+		
 		glPopMatrix();
+		ofPopStyle();
+		
+		c.fbo.end();
+		
+		c.rect = r;
+		c.dirty = false;
+		
+		intn.context->num_cache_renders++;
 	}
+	
+	c.fbo.draw(r.x, r.y, r.width, r.height);
+	intn.context->num_draw_calls++;
 }
 
-void Node::update(const Internal &)
+void Node::updateGlobalTransform()
 {
-	static Internal intn;
+	if (!transform_dirty) return;
+	
+	Node *p = getParent();
+	
+	const ofMatrix4x4 local = getLocalTransformMatrix();
+	
+	Affine2D local_affine;
+	if (affine_2d
+		&& p && p->global_is_2d
+		&& Affine2D::fromMatrix(local, local_affine)
+		&& (global_affine = local_affine * p->global_affine).getInverse(global_affine_inverse))
+	{
+		global_affine.toMatrix(global_matrix);
+		global_affine_inverse.toMatrix(global_matrix_inverse);
+		global_is_2d = true;
+	}
+	else
+	{
+		if (p)
+			global_matrix = local * p->global_matrix;
+		else
+			global_matrix = local;
+		
+		setGlobalTransform(global_matrix, global_matrix.getInverse());
+	}
+	
+	transform_dirty = false;
+	
+	// propagate to the subtree, children are updated after their parent
+	for (Node *o = first_child; o; o = o->next_sibling)
+		o->transform_dirty = true;
+}
+
+// events and handlers may move nodes between updates. recompute what this
+// node or an ancestor changed since, a parent marks its children dirty
+void Node::refreshGlobalTransform()
+{
+	Node *p = getParent();
+	if (p) p->refreshGlobalTransform();
+	
+	updateGlobalTransform();
+}
+
+void Node::setGlobalTransform(const ofMatrix4x4& m, const ofMatrix4x4& inv)
+{
+	global_matrix = m;
+	global_matrix_inverse = inv;
+	
+	// a general matrix that happens to be 2D still lets 2D children take the fast path
+	global_is_2d = Affine2D::fromMatrix(m, global_affine)
+		&& Affine2D::fromMatrix(inv, global_affine_inverse);
+}
 
+void Node::markTransformDirty()
+{
+	transform_dirty = true;
+	
+	if (transform_store)
+		transform_store->markDirty(transform_index);
+	
+	// a cached node composites with its own transform, only the caches above it change
+	Node *p = getParent();
+	if (p) p->markRenderDirty();
+}
+
+void Node::setCached(bool v)
+{
+	if (v == isCached()) return;
+	
+	if (v)
+	{
+		render_cache = new RenderCache;
+	}
+	else
+	{
+		delete render_cache;
+		render_cache = NULL;
+	}
+}
+
+void Node::markRenderDirty()
+{
+	for (Node *p = this; p; p = p->getParent())
+	{
+		if (p->render_cache) p->render_cache->dirty = true;
+	}
+}
+
+void Node::update(const Internal &intn)
+{
 	if (getVisible())
 	{
-		global_matrix = getGlobalTransformMatrix();
-		global_matrix_inverse = global_matrix.getInverse();
+		updateGlobalTransform();
 
-		update();
+		Context *context = intn.context;
+		Profiler *profiler = context ? &context->profiler : NULL;
+		
+		{
+			Profiler::Scope<Node> scope(profiler, Profiler::UPDATE, this, object_id);
+			update();
+		}
+		
+		if (context) update_order = context->update_counter++;
+		
+		ofRectangle r;
+		subtree_bounds.clear();
+		subtree_bounded = getLocalBounds(r);
+		if (subtree_bounded) subtree_bounds.grow(r, global_matrix);
+		subtree_size = 1;
+		
+		if (context && context->isCPUPicking() && getEnable())
+		{
+			{
+				Profiler::Scope<Node> scope(profiler, Profiler::HITTEST, this, object_id);
+				recordHitShapes();
+			}
+			
+			if (!hit_shapes.empty())
+			{
+				Bounds bounds;
+				bounds.grow(hit_rect, global_matrix);
+				context->spatial_index.add(object_id, bounds);
+			}
+		}
 
-		for (int i = 0; i < children.size(); i++)
+		for (Node *o = first_child; o; o = o->next_sibling)
 		{
-			if (children[i]->getVisible())
-				children[i]->update(intn);
+			if (!o->getVisible()) continue;
+			
+			o->update(intn);
+			
+			subtree_size += o->subtree_size;
+			
+			if (o->subtree_bounded)
+				subtree_bounds.grow(o->subtree_bounds);
+			else
+				subtree_bounded = false;
 		}
 	}
 }
 
 void Node::cancelFocus()
 {
-	getContext()->clearFocus();
+	Context *context = getContext();
+	if (context) context->clearFocus();
 }
 
 // RootNode
 
-RootNode::RootNode() : context(new Context)
+RootNode::RootNode() : context(new Context(this))
 {
 }
 
@@ -616,54 +1806,89 @@ void RootNode::draw()
 		update();
 	
 	getContext()->prepare();
+	
+	context->num_culled = 0;
+	context->num_draw_calls = 0;
+	context->num_cache_renders = 0;
+	
+	const bool gl = context->backend->canRender();
+	
+	// without GL only the batch is built
+	if (!gl && !context->batching) return;
+	
+	// nodes are expected to restore any raw GL state they change,
+	// the matrix and ofStyle are put back here
+	if (gl)
+	{
+		glPushMatrix();
+		ofPushStyle();
+	}
 
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
-	glPushMatrix();
-	ofPushStyle();
-
-	static Internal intn;
+	Internal intn(context);
 
-	if (getVisible())
+	if (getVisible() && context->batching)
+	{
+		context->batch.clear();
+		context->batch.setDefaultColor(gl ? ofGetStyle().color : ofColor(255));
+		context->batch.setView(context->modelViewProjectionMatrix, context->viewport);
+		
+		// global matrices already contain the root transform
+		for (Node *o = first_child; o; o = o->next_sibling)
+			context->drawBatched(o);
+		
+		// keep the last run around for inspection
+		context->flushBatch(false);
+	}
+	else if (getVisible())
 	{
 		glPushMatrix();
 		glMultMatrixf(getLocalTransformMatrix().getPtr());
 
-		for (int i = 0; i < children.size(); i++)
+		for (Node *o = first_child; o; o = o->next_sibling)
 		{
-			if (children[i]->getVisible())
-				children[i]->draw(intn);
+			if (o->getVisible())
+				o->draw(intn);
 		}
 
 		glPopMatrix();
 	}
 
-	ofPopStyle();
-	glPopMatrix();
-	glPopAttrib();
+	if (gl)
+	{
+		ofPopStyle();
+		glPopMatrix();
+	}
 }
 
 void RootNode::update()
 {
+	context->profiler.frameStarted();
+	context->gl_state.resetCounters();
+	
 	getContext()->update();
 	
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
-	glPushMatrix();
-	ofPushStyle();
-
-	static Internal intn;
+	// issues no GL, hit shapes are recorded on the CPU
+	Internal intn(context);
 
 	if (getVisible())
 	{
-		for (int i = 0; i < children.size(); i++)
+		bool root_changed = transform_dirty;
+		updateGlobalTransform();
+		
+		// recomputes everything that is dirty, the per node pass below skips it
+		context->transform_store.update(this, root_changed);
+		
+		for (Node *o = first_child; o; o = o->next_sibling)
 		{
-			if (children[i]->getVisible())
-				children[i]->update(intn);
+			if (o->getVisible())
+				o->update(intn);
 		}
 	}
 
-	ofPopStyle();
-	glPopMatrix();
-	glPopAttrib();
+	getContext()->updateFinished();
+	
+	// coalesced events are resolved against the transforms of this frame
+	getContext()->flushEvents();
 }
 
 Context* RootNode::getContext()
@@ -686,4 +1911,146 @@ void RootNode::disableAllEvent()
 	getContext()->disableAllEvent();
 }
 
+void RootNode::setPickingMode(PickingMode mode)
+{
+	context->picking_mode = mode;
+}
+
+RootNode::PickingMode RootNode::getPickingMode()
+{
+	return context->picking_mode;
+}
+
+void RootNode::setEventCoalescing(bool v)
+{
+	context->setEventCoalescing(v);
+}
+
+bool RootNode::getEventCoalescing()
+{
+	return context->coalesce_events;
+}
+
+void RootNode::setTransformStoreEnabled(bool v)
+{
+	context->transform_store.setEnabled(this, v);
+}
+
+bool RootNode::getTransformStoreEnabled()
+{
+	return context->transform_store.isEnabled();
+}
+
+void RootNode::setBackend(Backend *backend)
+{
+	context->setBackend(backend);
+}
+
+Profiler& RootNode::getProfiler()
+{
+	return context->profiler;
+}
+
+void RootNode::setDrawCulling(bool v)
+{
+	context->draw_culling = v;
+}
+
+bool RootNode::getDrawCulling()
+{
+	return context->draw_culling;
+}
+
+unsigned int RootNode::getNumCulledNodes()
+{
+	return context->num_culled;
+}
+
+unsigned int RootNode::getNumCacheRenders()
+{
+	return context->num_cache_renders;
+}
+
+void RootNode::setBatching(bool v)
+{
+	context->batching = v;
+}
+
+bool RootNode::getBatching()
+{
+	return context->batching;
+}
+
+const Batch& RootNode::getBatch()
+{
+	return context->batch;
+}
+
+unsigned int RootNode::getNumDrawCalls()
+{
+	return context->num_draw_calls;
+}
+
+unsigned int RootNode::getNumStateChanges()
+{
+	return context->gl_state.getNumChanges();
+}
+
+unsigned int RootNode::getNumRedundantStateChanges()
+{
+	return context->gl_state.getNumRedundantChanges();
+}
+
+Backend* RootNode::getBackend()
+{
+	return context->backend;
+}
+
+static ofMouseEventArgs makeMouseEvent(int x, int y, int button)
+{
+	ofMouseEventArgs e;
+	e.x = x;
+	e.y = y;
+	e.button = button;
+	return e;
+}
+
+void RootNode::notifyMousePressed(int x, int y, int button)
+{
+	ofMouseEventArgs e = makeMouseEvent(x, y, button);
+	context->mousePressed(e);
+}
+
+void RootNode::notifyMouseReleased(int x, int y, int button)
+{
+	ofMouseEventArgs e = makeMouseEvent(x, y, button);
+	context->mouseReleased(e);
+}
+
+void RootNode::notifyMouseMoved(int x, int y)
+{
+	ofMouseEventArgs e = makeMouseEvent(x, y, 0);
+	context->mouseMoved(e);
+}
+
+void RootNode::notifyMouseDragged(int x, int y, int button)
+{
+	ofMouseEventArgs e = makeMouseEvent(x, y, button);
+	context->mouseDragged(e);
+}
+
+void RootNode::notifyKeyPressed(int key)
+{
+	ofKeyEventArgs e;
+	e.key = key;
+	context->keyPressed(e);
+}
+
+void RootNode::notifyKeyReleased(int key)
+{
+	ofKeyEventArgs e;
+	e.key = key;
+	context->keyReleased(e);
+}
+
 
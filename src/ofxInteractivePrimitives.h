@@ -4,11 +4,20 @@
 
 #include <assert.h>
 
+#include "ofxIPSpatialIndex.h"
+#include "ofxIPSlotMap.h"
+#include "ofxIPAffine2D.h"
+#include "ofxIPBackend.h"
+#include "ofxIPProfiler.h"
+#include "ofxIPPool.h"
+#include "ofxIPBatch.h"
+
 namespace ofxInteractivePrimitives
 {
 	class Context;
 	class Node;
 	class RootNode;
+	class TransformStore;
 }
 
 class ofxInteractivePrimitives::Node : public ofNode
@@ -18,6 +27,7 @@ class ofxInteractivePrimitives::Node : public ofNode
 public:
 
 	friend class Context;
+	friend class TransformStore;
 
 	Node();
 	virtual ~Node();
@@ -27,6 +37,17 @@ public:
 	virtual void update() {}
 	virtual void draw() {}
 	virtual void hittest() {}
+	
+	// batched drawing, see RootNode::setBatching(). write the node in local
+	// coordinates and return true, or return false to be drawn with draw().
+	// a subclass that overrides draw() has to override this as well.
+	virtual bool drawBatched(Batch &batch) { return false; }
+	
+	// local space rect that contains everything the node draws and hit tests.
+	// reporting it is a promise, nodes outside the viewport are not drawn and
+	// nodes outside the pick region are not hit tested. return false when
+	// unknown, the default, such nodes and their parents are never culled.
+	virtual bool getLocalBounds(ofRectangle& r) { return false; }
 
 	virtual void mousePressed(int x, int y, int button)
 	{
@@ -70,6 +91,10 @@ public:
 
 	virtual void keyPressed(int key) {}
 	virtual void keyReleased(int key) {}
+	
+	// called when the hover state changes
+	virtual void mouseEntered() {}
+	virtual void mouseExited() {}
 
 	//
 
@@ -78,11 +103,27 @@ public:
 	bool hasParent() { return ofNode::getParent() != NULL; }
 	void clearParent();
 	
-	vector<Node*> getChildren() { return children; }
+	// children without copying:
+	//   for (Node *o = getFirstChild(); o; o = o->getNextSibling())
+	Node* getFirstChild() const { return first_child; }
+	Node* getLastChild() const { return last_child; }
+	Node* getNextSibling() const { return next_sibling; }
+	Node* getPrevSibling() const { return prev_sibling; }
+	size_t getNumChildren() const { return num_children; }
+	
+	// copy of the child list
+	vector<Node*> getChildren();
+	
+	// move every child under new_parent in one splice.
+	// within the same context the children keep their object ids.
+	void moveChildrenTo(Node *new_parent);
+	
+	// detach every child, they are unregistered and become roots of their subtrees
+	void detachChildren();
 	
 	//
 
-	inline void setVisible(bool v) { visible = v; }
+	inline void setVisible(bool v) { if (visible != v) { visible = v; markRenderDirty(); } }
 	inline bool getVisible() const { return visible; }
 	inline bool isVisible() const { return visible; }
 
@@ -96,6 +137,17 @@ public:
 	inline bool getEnable() { return enable; }
 	inline bool isEnable() { return enable; }
 	
+	// render the subtree once into an offscreen buffer and composite it until
+	// something in it is marked dirty. needs bounds from getLocalBounds() on
+	// the whole subtree, drawing outside of them is clipped
+	void setCached(bool v);
+	bool isCached() const { return render_cache != NULL; }
+	
+	// re-render every cached subtree this node is part of. hover, down, focus,
+	// transforms and the child list do this already, nodes that draw other
+	// state call it when that state changes
+	void markRenderDirty();
+	
 
 	// utils
 
@@ -108,27 +160,122 @@ public:
 
 protected:
 
-	struct Internal {};
+	struct Internal
+	{
+		Context *context;
+		bool caching;
+		Internal(Context *context = NULL, bool caching = false) : context(context), caching(caching) {}
+	};
+	
 	void draw(const Internal &);
+	void drawContents(const Internal &);
+	void drawCached(const Internal &);
 	void update(const Internal &);
 
 	virtual Context* getContext();
 	const vector<GLuint>& getCurrentNameStack();
 	
-	inline void pushID(int id) { glPushName(id); }
-	inline void popID() { glPopName(); }
+	void pushID(int id);
+	void popID();
+
+	// hit shapes in local space, call these from hittest().
+	// with GL_SELECT picking they are drawn into the selection buffer,
+	// with CPU picking they are recorded and tested without GL.
+
+	void hitRect(const ofRectangle& r);
+	void hitRect(float x, float y, float w, float h) { hitRect(ofRectangle(x, y, w, h)); }
+	void hitCircle(float x, float y, float radius);
+	void hitLine(const ofVec3f& p0, const ofVec3f& p1, float width = 3);
+	void hitPolygon(const vector<ofVec2f>& points);
 
 	void cancelFocus();
 	
+	// purely 2D nodes (Element2D and its subclasses) take the affine fast path
+	void setAffine2D(bool v) { affine_2d = v; transform_dirty = true; }
+	bool isAffine2D() const { return affine_2d; }
+	
+	// ofNode notifications, mark the cached global transform as stale
+	void onPositionChanged() { markTransformDirty(); }
+	void onOrientationChanged() { markTransformDirty(); }
+	void onScaleChanged() { markTransformDirty(); }
+	
 private:
 
 	unsigned int object_id;
 	bool hover, down, focus, visible, enable;
 
+	// recomputed in update only when this node or one of its parents changed
 	ofMatrix4x4 global_matrix, global_matrix_inverse;
-	vector<Node*> children;
+	bool transform_dirty;
+	
+	// 2D fast path: nodes that opt in with setAffine2D() compose and invert
+	// 3x2 matrices while they and all their parents stay in the xy plane
+	bool affine_2d, global_is_2d;
+	Affine2D global_affine, global_affine_inverse;
+	
+	// slot in the transform store when it is enabled
+	TransformStore *transform_store;
+	int transform_index;
+	
+	struct RenderCache
+	{
+		ofFbo fbo;
+		ofRectangle rect;
+		bool dirty;
+		
+		RenderCache() : dirty(true) {}
+	};
+	
+	RenderCache *render_cache;
+	
+	// intrusive child list, attach and detach are O(1)
+	Node *first_child, *last_child;
+	Node *prev_sibling, *next_sibling;
+	size_t num_children;
+	
+	void linkChild(Node *o);
+	void unlinkChild(Node *o);
+	
+	// world space bounds of this node and its visible descendants, from the last update
+	Bounds subtree_bounds;
+	bool subtree_bounded;
+	unsigned int subtree_size;
+	unsigned int update_order;
 
 	void clearState();
+	void invalidateSubtreeBounds();
+	void updateGlobalTransform();
+	void refreshGlobalTransform();
+	void setGlobalTransform(const ofMatrix4x4& m, const ofMatrix4x4& inv);
+	void markTransformDirty();
+
+	struct HitShape
+	{
+		enum Type
+		{
+			RECT,
+			CIRCLE,
+			SEGMENT,
+			POLYGON
+		};
+
+		Type type;
+		float radius;
+		int point_offset, num_points;
+		int name_offset, num_names;
+	};
+
+	// recorded hit shapes, flat so that re-recording every frame reuses storage
+	bool hit_recording;
+	vector<HitShape> hit_shapes;
+	vector<ofVec2f> hit_points;
+	vector<GLuint> hit_names, hit_name_stack;
+	ofRectangle hit_rect;
+
+	void beginHitShape(HitShape::Type type, float radius);
+	void addHitPoint(const ofVec2f& p);
+	void recordHitShapes();
+	bool testHitShapes(const ofVec2f& p, float tolerance, vector<GLuint>& names) const;
 
 };
 
@@ -136,6 +283,12 @@ class ofxInteractivePrimitives::RootNode : public ofxInteractivePrimitives::Node
 {
 public:
 
+	enum PickingMode
+	{
+		PICKING_GL_SELECT,
+		PICKING_CPU
+	};
+
 	RootNode();
 	~RootNode();
 
@@ -146,6 +299,60 @@ public:
 	
 	void enableAllEvent();
 	void disableAllEvent();
+	
+	void setPickingMode(PickingMode mode);
+	PickingMode getPickingMode();
+	
+	// queue mouse and key events and dispatch them once per update
+	void setEventCoalescing(bool v);
+	bool getEventCoalescing();
+	
+	// keep all transforms in contiguous arrays ordered by depth
+	void setTransformStoreEnabled(bool v);
+	bool getTransformStoreEnabled();
+	
+	// takes ownership. use a NullBackend to run the scene without GL
+	void setBackend(Backend *backend);
+	Backend* getBackend();
+	
+	// off by default, see ofxIPProfiler.h
+	Profiler& getProfiler();
+	
+	// skip drawing subtrees whose bounds are outside the viewport, on by default
+	void setDrawCulling(bool v);
+	bool getDrawCulling();
+	
+	// nodes skipped by the last draw
+	unsigned int getNumCulledNodes();
+	
+	// cached subtrees that had to be rendered again in the last draw
+	unsigned int getNumCacheRenders();
+	
+	// collect built-in widgets into one Batch and submit it in a few draw calls.
+	// the batch is built without GL too, e.g. with a NullBackend
+	void setBatching(bool v);
+	bool getBatching();
+	
+	// contents since the last flush of the last draw
+	const Batch& getBatch();
+	
+	// batch draw calls plus nodes drawn with draw() in the last draw
+	unsigned int getNumDrawCalls();
+	
+	// GL and ofStyle changes made by the addon since the last update,
+	// and how many of them were skipped because nothing would change.
+	// only batched drawing and GL_SELECT setup are counted, draw() and
+	// hittest() of the nodes set their own style
+	unsigned int getNumStateChanges();
+	unsigned int getNumRedundantStateChanges();
+	
+	// feed events directly instead of through ofEvents(), e.g. when headless
+	void notifyMousePressed(int x, int y, int button);
+	void notifyMouseReleased(int x, int y, int button);
+	void notifyMouseMoved(int x, int y);
+	void notifyMouseDragged(int x, int y, int button);
+	void notifyKeyPressed(int key);
+	void notifyKeyReleased(int key);
 
 protected:
 
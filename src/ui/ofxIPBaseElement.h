@@ -13,6 +13,7 @@ public:
 
 	Element2D(Node &root) : Node()
 	{
+		setAffine2D(true);
 		setParent(&root);
 	}
 	
@@ -22,7 +23,13 @@ public:
 	float getContentHeight() const { return rect.height; }
 
 	const ofRectangle& getContentRect() const { return rect; }
-	void setContentRect(const ofRectangle& o) { rect = o; }
+	void setContentRect(const ofRectangle& o)
+	{
+		if (o.x == rect.x && o.y == rect.y && o.width == rect.width && o.height == rect.height) return;
+		
+		rect = o;
+		markRenderDirty();
+	}
 	
 private:
 	
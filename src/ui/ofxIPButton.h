@@ -40,5 +40,30 @@ public:
 
 		ofDrawBitmapString(text, MARGIN, BITMAP_CHAR_HEIGHT + MARGIN);
 	}
+	
+	bool drawBatched(Batch &batch)
+	{
+		if (isDown())
+		{
+			batch.setColor(0, 255, 0);
+			batch.addRect(getContentRect(), true);
+
+			batch.setColor(0, 127, 0);
+		}
+		else if (isHover())
+		{
+			batch.setColor(255, 0, 255);
+			batch.addRect(getContentRect(), false);
+		}
+		else
+		{
+			batch.setColor(0, 255, 0);
+			batch.addRect(getContentRect(), false);
+		}
+
+		drawText(batch);
+		
+		return true;
+	}
 
 };
@@ -47,18 +47,53 @@ public:
 		ofDrawBitmapString(text, 4, 14);
 	}
 
+	bool drawBatched(Batch &batch)
+	{
+		batch.setColor(255, 0, 0);
+		
+		batch.addLine(-10, 0, 10, 0);
+		batch.addLine(0, -10, 0, 10);
+		
+		if (isDown())
+			batch.addRect(-6, -6, 12, 12, false);
+		else if (isHover())
+			batch.addRect(-3, -3, 6, 6, false);
+		
+		batch.setColor(0, 255, 0);
+		batch.addText(text, 4, 14);
+		
+		return true;
+	}
+
 	void hittest()
 	{
 		ofFill();
-		ofRect(-15, -15, 30, 30);
+		hitRect(-15, -15, 30, 30);
 	}
 
 	void mouseDragged(int x, int y, int button)
 	{
 		move(getMouseDelta());
 	}
+	
+	bool getLocalBounds(ofRectangle& r)
+	{
+		r.set(-15, -15, 30, 30);
+		
+		// label
+		float w = 4 + text.size() * 8;
+		if (w > 15) r.width = w + 15;
+		
+		return true;
+	}
 
-	void setText(const string& s) { text = s; }
+	void setText(const string& s)
+	{
+		if (text == s) return;
+		
+		text = s;
+		markRenderDirty();
+	}
 	const string& getText() { return text; }
 
 protected:
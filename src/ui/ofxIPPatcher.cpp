@@ -4,7 +4,7 @@ using namespace ofxInteractivePrimitives;
 
 // PatchCord
 
-PatchCord::PatchCord(Port *upstream_port, Port *downstream_port) : upstream(upstream_port), downstream(downstream_port)
+PatchCord::PatchCord(Port *upstream_port, Port *downstream_port) : upstream(upstream_port), downstream(downstream_port), conversion(NULL)
 {
 	getUpstream()->addCord(this);
 	getDownstream()->addCord(this);
@@ -43,6 +43,23 @@ void PatchCord::draw()
 	ofPopStyle();
 }
 
+bool PatchCord::drawBatched(Batch &batch)
+{
+	if (!isValid()) return true;
+	
+	const ofVec3f p0 = getUpstream()->getPos();
+	const ofVec3f p1 = getUpstream()->getPatcher()->globalToLocalPos(getDownstream()->getGlobalPos());
+	
+	batch.setLineWidth(this->isHover() ? 2 : 1);
+	
+	if (this->isFocus())
+		batch.setColor(ofColor::fromHex(0xCCFF77), 127);
+	
+	batch.addLine(p0, p1);
+	
+	return true;
+}
+
 void PatchCord::hittest()
 {
 	if (!isValid()) return;
@@ -50,8 +67,22 @@ void PatchCord::hittest()
 	const ofVec3f p0 = getUpstream()->getPos();
 	const ofVec3f p1 = getUpstream()->getPatcher()->globalToLocalPos(getDownstream()->getGlobalPos());
 	
-	ofSetLineWidth(3);
-	ofLine(p0, p1);
+	hitLine(p0, p1, 3);
+}
+
+bool PatchCord::getLocalBounds(ofRectangle& r)
+{
+	if (!isValid()) return false;
+	
+	const ofVec3f p0 = getUpstream()->getPos();
+	const ofVec3f p1 = getUpstream()->getPatcher()->globalToLocalPos(getDownstream()->getGlobalPos());
+	
+	r.x = min(p0.x, p1.x) - 2;
+	r.y = min(p0.y, p1.y) - 2;
+	r.width = fabs(p1.x - p0.x) + 4;
+	r.height = fabs(p1.y - p0.y) + 4;
+	
+	return true;
 }
 
 void PatchCord::keyPressed(int key)
@@ -69,12 +100,11 @@ Port::Port(BasePatcher *patcher, int index, PortIdentifer::Direction direction)
 {
 }
 
-void Port::execute(MessageRef message)
+void Port::execute(const MessageRef& message)
 {
 	if (direction == PortIdentifer::INPUT)
 	{
-		data = message;
-		patcher->inputDataUpdated(index);
+		receive(message, NULL);
 	}
 	else if (direction == PortIdentifer::OUTPUT)
 	{
@@ -83,13 +113,39 @@ void Port::execute(MessageRef message)
 		{
 			PatchCord *cord = *it;
 			Port *port = cord->getDownstream();
-			if (port) port->execute(message);
+			
+			if (port) port->receive(message, cord->conversion);
 			
 			it++;
 		}
 	}
 }
 
+// the value is copied, the message stays with the sender. the slot keeps
+// its own message and is updated in place from the second value on
+void Port::receive(const MessageRef& message, TypeConversion::Function conversion)
+{
+	MessageRef *slot = patcher->getInputSlot(index);
+	if (slot == NULL) return;
+	
+	if (!message)
+		slot->reset();
+	else if (conversion)
+		conversion(message, *slot);
+	else
+		message->copyTo(*slot);
+	
+	patcher->inputDataUpdated(index);
+}
+
+TypeID Port::getType() const
+{
+	if (direction == PortIdentifer::INPUT)
+		return patcher->getInputType(index);
+	else
+		return patcher->getOutputType(index);
+}
+
 ofVec3f Port::getGlobalPos() const
 {
 	return patcher->localToGlobalPos(getPos());
@@ -109,3 +165,526 @@ bool Port::hasConnectTo(Port *port)
 	
 	return false;
 }
+
+// BasePatcher
+
+BasePatcher::BasePatcher() : scheduler(NULL), scheduled(false), topological_index(-1), visit_epoch(0), tick_epoch(0), num_pending_upstream(0)
+{
+	TopologicalOrder::get().add(this);
+}
+
+BasePatcher::~BasePatcher()
+{
+	setScheduler(NULL);
+	TopologicalOrder::get().remove(this);
+}
+
+void BasePatcher::setScheduler(Scheduler *s)
+{
+	if (scheduler == s) return;
+	
+	if (scheduler) scheduler->detach(this);
+	scheduler = s;
+	if (scheduler) scheduler->attach(this);
+}
+
+void BasePatcher::getDownstream(vector<BasePatcher*>& out)
+{
+	out.clear();
+	
+	for (int i = 0; i < getNumOutput(); i++)
+	{
+		const Port::CordContainerType &cords = getOutputPort(i).getCords();
+		
+		Port::CordContainerType::const_iterator it = cords.begin();
+		while (it != cords.end())
+		{
+			Port *port = (*it)->getDownstream();
+			if (port) out.push_back(port->getPatcher());
+			
+			it++;
+		}
+	}
+}
+
+void BasePatcher::getUpstream(vector<BasePatcher*>& out)
+{
+	out.clear();
+	
+	for (int i = 0; i < getNumInput(); i++)
+	{
+		const Port::CordContainerType &cords = getInputPort(i).getCords();
+		
+		Port::CordContainerType::const_iterator it = cords.begin();
+		while (it != cords.end())
+		{
+			Port *port = (*it)->getUpstream();
+			if (port) out.push_back(port->getPatcher());
+			
+			it++;
+		}
+	}
+}
+
+// TopologicalOrder
+
+void TopologicalOrder::add(BasePatcher *patcher)
+{
+	// a new patcher has no cords, the end of the order is fine
+	patcher->topological_index = slots.size();
+	slots.push_back(patcher);
+}
+
+void TopologicalOrder::remove(BasePatcher *patcher)
+{
+	const int i = patcher->topological_index;
+	if (i < 0 || i >= (int)slots.size() || slots[i] != patcher) return;
+	
+	slots[i] = NULL;
+	patcher->topological_index = -1;
+	num_holes++;
+	
+	if (num_holes > 64 && num_holes * 2 > slots.size()) compact();
+}
+
+void TopologicalOrder::compact()
+{
+	size_t n = 0;
+	
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		BasePatcher *p = slots[i];
+		if (p == NULL) continue;
+		
+		p->topological_index = n;
+		slots[n++] = p;
+	}
+	
+	slots.resize(n);
+	num_holes = 0;
+}
+
+void TopologicalOrder::getOrder(vector<BasePatcher*>& out) const
+{
+	out.clear();
+	out.reserve(size());
+	
+	for (size_t i = 0; i < slots.size(); i++)
+		if (slots[i]) out.push_back(slots[i]);
+}
+
+bool TopologicalOrder::connect(BasePatcher *upstream, BasePatcher *downstream)
+{
+	const int lower_bound = downstream->topological_index;
+	const int upper_bound = upstream->topological_index;
+	
+	assert(lower_bound >= 0 && upper_bound >= 0);
+	
+	// already in order
+	if (lower_bound > upper_bound) return true;
+	
+	epoch++;
+	
+	forward.clear();
+	backward.clear();
+	
+	if (!searchForward(downstream, upstream)) return false;
+	
+	searchBackward(upstream, lower_bound);
+	reorder();
+	
+	return true;
+}
+
+// everything downstream of from that sits before target in the order.
+// reaching target means the new cord would close a cycle
+bool TopologicalOrder::searchForward(BasePatcher *from, BasePatcher *target)
+{
+	const int upper_bound = target->topological_index;
+	
+	stack.clear();
+	stack.push_back(from);
+	from->visit_epoch = epoch;
+	
+	while (!stack.empty())
+	{
+		BasePatcher *p = stack.back();
+		stack.pop_back();
+		
+		forward.push_back(p);
+		
+		p->getDownstream(adjacent);
+		
+		for (size_t i = 0; i < adjacent.size(); i++)
+		{
+			BasePatcher *q = adjacent[i];
+			
+			if (q == target) return false;
+			
+			if (q->visit_epoch != epoch && q->topological_index < upper_bound)
+			{
+				q->visit_epoch = epoch;
+				stack.push_back(q);
+			}
+		}
+	}
+	
+	return true;
+}
+
+// everything upstream of from that sits after lower_bound in the order
+void TopologicalOrder::searchBackward(BasePatcher *from, int lower_bound)
+{
+	stack.clear();
+	stack.push_back(from);
+	from->visit_epoch = epoch;
+	
+	while (!stack.empty())
+	{
+		BasePatcher *p = stack.back();
+		stack.pop_back();
+		
+		backward.push_back(p);
+		
+		p->getUpstream(adjacent);
+		
+		for (size_t i = 0; i < adjacent.size(); i++)
+		{
+			BasePatcher *q = adjacent[i];
+			
+			if (q->visit_epoch != epoch && q->topological_index > lower_bound)
+			{
+				q->visit_epoch = epoch;
+				stack.push_back(q);
+			}
+		}
+	}
+}
+
+// hand the indices of both sets out again, upstream set first
+void TopologicalOrder::reorder()
+{
+	sort(backward.begin(), backward.end(), compareIndex);
+	sort(forward.begin(), forward.end(), compareIndex);
+	
+	indices.clear();
+	
+	for (size_t i = 0; i < backward.size(); i++)
+		indices.push_back(backward[i]->topological_index);
+	
+	for (size_t i = 0; i < forward.size(); i++)
+		indices.push_back(forward[i]->topological_index);
+	
+	sort(indices.begin(), indices.end());
+	
+	size_t n = 0;
+	
+	for (size_t i = 0; i < backward.size(); i++, n++)
+	{
+		backward[i]->topological_index = indices[n];
+		slots[indices[n]] = backward[i];
+	}
+	
+	for (size_t i = 0; i < forward.size(); i++, n++)
+	{
+		forward[i]->topological_index = indices[n];
+		slots[indices[n]] = forward[i];
+	}
+}
+
+// Scheduler
+
+Scheduler::~Scheduler()
+{
+	setNumThreads(0);
+	
+	set<BasePatcher*>::iterator it = patchers.begin();
+	while (it != patchers.end())
+	{
+		BasePatcher *p = *it;
+		p->scheduler = NULL;
+		p->scheduled = false;
+		
+		it++;
+	}
+}
+
+void Scheduler::setNumThreads(int num_threads)
+{
+	assert(!running);
+	
+	if (num_threads == getNumThreads()) return;
+	
+	delete pool;
+	pool = num_threads > 0 ? new ThreadPool(num_threads) : NULL;
+}
+
+void Scheduler::attach(BasePatcher *patcher)
+{
+	patchers.insert(patcher);
+}
+
+void Scheduler::detach(BasePatcher *patcher)
+{
+	patchers.erase(patcher);
+	
+	if (patcher->scheduled)
+	{
+		patcher->scheduled = false;
+		
+		dirty.erase(std::remove(dirty.begin(), dirty.end(), patcher), dirty.end());
+		deferred.erase(std::remove(deferred.begin(), deferred.end(), patcher), deferred.end());
+		
+		if (running) make_heap(dirty.begin(), dirty.end(), compareIndex);
+	}
+}
+
+void Scheduler::markDirty(BasePatcher *patcher)
+{
+	assert(patcher->scheduler == this);
+	
+	if (patcher->scheduled) return;
+	
+	patcher->scheduled = true;
+	
+	if (!running)
+	{
+		dirty.push_back(patcher);
+	}
+	else if (pool)
+	{
+		// a parallel tick picks it up once its upstream patchers are done
+		if (patcher->tick_epoch != epoch || patcher->num_pending_upstream <= 0)
+			deferred.push_back(patcher);
+	}
+	else if (patcher->topological_index > current_index)
+	{
+		dirty.push_back(patcher);
+		push_heap(dirty.begin(), dirty.end(), compareIndex);
+	}
+	else
+	{
+		// the tick is past it, running it now could repeat upstream patchers
+		deferred.push_back(patcher);
+	}
+}
+
+void Scheduler::tick()
+{
+	num_executed = 0;
+	
+	if (dirty.empty()) return;
+	
+	if (pool)
+		tickParallel();
+	else
+		tickSequential();
+}
+
+void Scheduler::tickSequential()
+{
+	running = true;
+	make_heap(dirty.begin(), dirty.end(), compareIndex);
+	
+	while (!dirty.empty())
+	{
+		pop_heap(dirty.begin(), dirty.end(), compareIndex);
+		
+		BasePatcher *p = dirty.back();
+		dirty.pop_back();
+		
+		current_index = p->topological_index;
+		
+		// outputs mark the downstream patchers, all of them later in the order
+		p->scheduled = false;
+		p->execute();
+		num_executed++;
+	}
+	
+	running = false;
+	current_index = -1;
+	
+	dirty.swap(deferred);
+}
+
+void Scheduler::tickParallel()
+{
+	epoch++;
+	
+	// what the dirty patchers reach, with the cords into each counted
+	reached.clear();
+	
+	for (size_t i = 0; i < dirty.size(); i++)
+	{
+		BasePatcher *p = dirty[i];
+		
+		p->tick_epoch = epoch;
+		p->num_pending_upstream = 0;
+		reached.push_back(p);
+	}
+	
+	dirty.clear();
+	
+	for (size_t i = 0; i < reached.size(); i++)
+	{
+		reached[i]->getDownstream(downstream);
+		
+		for (size_t k = 0; k < downstream.size(); k++)
+		{
+			BasePatcher *q = downstream[k];
+			
+			if (q->tick_epoch != epoch)
+			{
+				q->tick_epoch = epoch;
+				q->num_pending_upstream = 0;
+				reached.push_back(q);
+			}
+			
+			q->num_pending_upstream++;
+		}
+	}
+	
+	// job addresses are handed to the pool, no reallocation while running
+	if (jobs.size() < reached.size()) jobs.resize(reached.size());
+	num_jobs = 0;
+	
+	main_thread.clear();
+	ready.clear();
+	computed.clear();
+	
+	num_remaining = reached.size();
+	running = true;
+	
+	// the roots are the dirty patchers nothing else reaches, collected
+	// first as dispatching changes the counts
+	roots.clear();
+	
+	for (size_t i = 0; i < reached.size(); i++)
+	{
+		if (reached[i]->num_pending_upstream == 0)
+			roots.push_back(reached[i]);
+	}
+	
+	for (size_t i = 0; i < roots.size(); i++)
+		dispatch(roots[i]);
+	
+	// workers only compute. publishing runs here, upstream first, so that
+	// whatever the outputs reach outside the scheduler runs on this thread
+	while (num_remaining > 0)
+	{
+		while (!main_thread.empty())
+		{
+			BasePatcher *p = main_thread.back();
+			main_thread.pop_back();
+			
+			p->compute();
+			
+			ready.push_back(p);
+			push_heap(ready.begin(), ready.end(), compareIndex);
+		}
+		
+		{
+			ofMutex::ScopedLock lock(mutex);
+			
+			for (size_t i = 0; i < computed.size(); i++)
+			{
+				ready.push_back(computed[i]);
+				push_heap(ready.begin(), ready.end(), compareIndex);
+			}
+			
+			computed.clear();
+		}
+		
+		if (!ready.empty())
+		{
+			pop_heap(ready.begin(), ready.end(), compareIndex);
+			
+			BasePatcher *p = ready.back();
+			ready.pop_back();
+			
+			p->publish();
+			finish(p);
+		}
+		else if (!pool->runPending(-1))
+		{
+			progress.wait();
+		}
+	}
+	
+	running = false;
+	
+	dirty.swap(deferred);
+}
+
+void Scheduler::dispatch(BasePatcher *patcher)
+{
+	patcher->num_pending_upstream = -1;
+	
+	// no new input reached it, or the publish upstream already ran it or
+	// queued it with its own scheduler. pass through
+	if (!patcher->scheduled || patcher->scheduler != this)
+	{
+		finish(patcher);
+		return;
+	}
+	
+	patcher->scheduled = false;
+	num_executed++;
+	
+	if (patcher->isThreadSafe())
+	{
+		Job &job = jobs[num_jobs++];
+		job.scheduler = this;
+		job.patcher = patcher;
+		
+		pool->submit(&job);
+	}
+	else
+	{
+		main_thread.push_back(patcher);
+	}
+}
+
+void Scheduler::finish(BasePatcher *patcher)
+{
+	finished.push_back(patcher);
+	
+	// iterative, pass through patchers finish right away
+	while (!finished.empty())
+	{
+		BasePatcher *p = finished.back();
+		finished.pop_back();
+		
+		num_remaining--;
+		
+		p->getDownstream(downstream);
+		
+		for (size_t i = 0; i < downstream.size(); i++)
+		{
+			BasePatcher *q = downstream[i];
+			if (--q->num_pending_upstream != 0) continue;
+			
+			if (q->scheduled && q->scheduler == this)
+			{
+				dispatch(q);
+			}
+			else
+			{
+				q->num_pending_upstream = -1;
+				finished.push_back(q);
+			}
+		}
+	}
+}
+
+void Scheduler::Job::run(int worker)
+{
+	patcher->compute();
+	
+	{
+		ofMutex::ScopedLock lock(scheduler->mutex);
+		scheduler->computed.push_back(patcher);
+	}
+	
+	scheduler->progress.set();
+}
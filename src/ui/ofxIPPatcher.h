@@ -4,8 +4,10 @@
 
 #include "ofxInteractivePrimitives.h"
 #include "ofxIPStringBox.h"
+#include "ofxIPThreadPool.h"
 
 #include <set>
+#include <typeinfo>
 
 
 namespace ofxInteractivePrimitives
@@ -20,9 +22,12 @@ namespace ofxInteractivePrimitives
 	template <typename T>
 	class Message;
 	
-	typedef ofPtr<BaseMessage> MessageRef;
+	class MessageRef;
 	
 	class BasePatcher;
+	class TopologicalOrder;
+	class Scheduler;
+	class TypeConversion;
 	
 	struct NullParam {};
 	
@@ -36,12 +41,27 @@ namespace ofxInteractivePrimitives
 	
 	typedef unsigned long TypeID;
 	
-	// TODO: more better RTTI method
+	// 32 bit FNV-1a of the type name. unlike the address of a static, the
+	// name is the same in every shared library and application
+	inline TypeID hashTypeName(const char *name)
+	{
+		unsigned int h = 2166136261u;
+		
+		for (const unsigned char *p = (const unsigned char*)name; *p; p++)
+		{
+			h ^= *p;
+			h *= 16777619u;
+		}
+		
+		return h;
+	}
+	
+	// void is the type of untyped ports, they connect to anything
 	template <typename T>
 	TypeID Type2Int()
 	{
-		const static unsigned int s = 0;
-		return (TypeID) & s;
+		static const TypeID id = hashTypeName(typeid(T).name());
+		return id;
 	};
 	
 	inline bool in_range(const int& a, const int& b, const int& c)
@@ -74,21 +94,22 @@ public:
 	static void deleteQueue()
 	{
 		Queue &queue = getQueue();
-		Queue::iterator it = queue.begin();
 		
-		while (it != queue.end())
+		// destructors may queue more objects
+		while (!queue.empty())
 		{
-			DelayedDeletable *o = *it;
-			delete o;
-			it++;
+			Queue q;
+			q.swap(queue);
+			
+			for (size_t i = 0; i < q.size(); i++)
+				delete q[i];
 		}
-		
-		queue.clear();
 	}
 	
 protected:
 	
-	static void addToDelayedDeleteQueue(DelayedDeletable *o) { getQueue().insert(o); }
+	// will_delete keeps every object in the queue once
+	static void addToDelayedDeleteQueue(DelayedDeletable *o) { getQueue().push_back(o); }
 	
 protected:
 	
@@ -96,7 +117,7 @@ protected:
 	
 private:
 	
-	typedef std::set<DelayedDeletable*> Queue;
+	typedef vector<DelayedDeletable*> Queue;
 	static Queue& getQueue() { static Queue queue; return queue; }
 	
 	bool will_delete;
@@ -105,25 +126,110 @@ private:
 
 #pragma mark - BaseMessage
 
+// intrusively counted, MessageRef holds the references. every message
+// sits in the slot of one port and ports copy values between slots, so a
+// message is never held on two threads at once and the count is plain
+
 class ofxInteractivePrimitives::BaseMessage : public DelayedDeletable
 {
+	friend class MessageRef;
+	
 public:
 	
+	BaseMessage() : ref_count(0) {}
 	virtual ~BaseMessage() {}
 	
+	int getRefCount() const { return ref_count; }
+	
 	virtual bool isTypeOf() const { return false; }
+	virtual TypeID getType() const { return Type2Int<void>(); }
 	
-	// TODO: add type checking
+	// NULL when the message holds another type
 	template <typename T>
-	Message<T>* cast() { return (Message<T>*) this; }
+	Message<T>* cast()
+	{
+		if (getType() != Type2Int<T>()) return NULL;
+		return static_cast<Message<T>*>(this);
+	}
+	
+	// no check, for ports whose type was checked when the cord was made
+	template <typename T>
+	Message<T>* as()
+	{
+		assert(getType() == Type2Int<T>());
+		return static_cast<Message<T>*>(this);
+	}
 	
 	void execute() {}
+	
+	// write the value into the message slot holds, in place when it can
+	virtual void copyTo(MessageRef& slot) const = 0;
+	
+private:
+	
+	int ref_count;
+	
+	void retain() { ++ref_count; }
+	void release() { if (--ref_count == 0) delete this; }
+	
+	// a copy would share nothing but the count
+	BaseMessage(const BaseMessage&);
+	BaseMessage& operator=(const BaseMessage&);
+};
+
+#pragma mark - MessageRef
+
+// assigning the message a ref already holds touches no count, so ports
+// and slots updated in place cost nothing per frame
+
+class ofxInteractivePrimitives::MessageRef
+{
+public:
+	
+	MessageRef() : ptr(NULL) {}
+	explicit MessageRef(BaseMessage *ptr) : ptr(ptr) { if (ptr) ptr->retain(); }
+	MessageRef(const MessageRef& o) : ptr(o.ptr) { if (ptr) ptr->retain(); }
+	~MessageRef() { if (ptr) ptr->release(); }
+	
+	MessageRef& operator=(const MessageRef& o)
+	{
+		if (ptr == o.ptr) return *this;
+		
+		// retain first, o may be owned by the message released here
+		BaseMessage *old = ptr;
+		ptr = o.ptr;
+		
+		if (ptr) ptr->retain();
+		if (old) old->release();
+		
+		return *this;
+	}
+	
+	void reset() { *this = MessageRef(); }
+	
+	BaseMessage* get() const { return ptr; }
+	BaseMessage* operator->() const { return ptr; }
+	BaseMessage& operator*() const { return *ptr; }
+	
+	// safe bool, a MessageRef does not convert to numbers
+	typedef BaseMessage* MessageRef::*unspecified_bool_type;
+	operator unspecified_bool_type() const { return ptr ? &MessageRef::ptr : NULL; }
+	
+	bool operator==(const MessageRef& o) const { return ptr == o.ptr; }
+	bool operator!=(const MessageRef& o) const { return ptr != o.ptr; }
+	
+	// only reference, an in place update is not seen by anyone else
+	bool unique() const { return ptr && ptr->getRefCount() == 1; }
+	
+private:
+	
+	BaseMessage *ptr;
 };
 
 #pragma mark - Message
 
 template <typename T>
-class ofxInteractivePrimitives::Message : public BaseMessage
+class ofxInteractivePrimitives::Message : public BaseMessage, public Pooled<Message<T>, true>
 {
 public:
 	
@@ -131,9 +237,13 @@ public:
 	Message(const T& value) : type(Type2Int<T>()), value(value) {}
 	
 	bool isTypeOf() const { return type == Type2Int<T>(); }
+	TypeID getType() const { return type; }
 	const T& get() { return value; }
-	bool set(const T& v) { value = v; }
+	void set(const T& v) { value = v; }
 	
+	void copyTo(MessageRef& slot) const { assign(slot, value); }
+	
+	// allocated from the pool of Message<T>
 	static MessageRef create(const T& v)
 	{
 		Message<T> *ptr = new Message<T>(v);
@@ -146,12 +256,115 @@ public:
 		return MessageRef(ptr);
 	}
 	
+	// write v into the Message<T> slot holds, allocating only when the slot
+	// is empty, holds another type or a ref to it is kept elsewhere, which
+	// may still read the old value. port slots are never shared, so this
+	// is the steady state of an output:
+	//
+	//   Message<float>::assign(output[0], v);
+	static Message<T>* assign(MessageRef& slot, const T& v)
+	{
+		if (slot.unique() && slot->getType() == Type2Int<T>())
+		{
+			Message<T> *m = slot->as<T>();
+			m->set(v);
+			return m;
+		}
+		
+		Message<T> *m = new Message<T>(v);
+		slot = MessageRef(m);
+		return m;
+	}
+	
 private:
 	
 	T value;
 	TypeID type;
 };
 
+#pragma mark - TypeConversion
+
+// how a message of one port type reaches an input of another, looked up
+// once when a cord is made. the cord converts straight into the slot of
+// the input, so a converted connection updates in place like a direct one.
+
+class ofxInteractivePrimitives::TypeConversion
+{
+public:
+	
+	typedef void (*Function)(const MessageRef& from, MessageRef& to);
+	
+	// anything static_cast can convert
+	template <typename From, typename To>
+	static void add()
+	{
+		getFunctions()[Key(Type2Int<From>(), Type2Int<To>())] = &convert<From, To>;
+	}
+	
+	static void add(TypeID from, TypeID to, Function f)
+	{
+		getFunctions()[Key(from, to)] = f;
+	}
+	
+	// same types and untyped ports connect as they are
+	static bool isDirect(TypeID from, TypeID to)
+	{
+		const TypeID any = Type2Int<void>();
+		return from == to || from == any || to == any;
+	}
+	
+	// NULL when there is no conversion
+	static Function find(TypeID from, TypeID to)
+	{
+		Map &m = getFunctions();
+		
+		Map::iterator it = m.find(Key(from, to));
+		if (it == m.end()) return NULL;
+		
+		return it->second;
+	}
+	
+	static bool isCompatible(TypeID from, TypeID to)
+	{
+		return isDirect(from, to) || find(from, to) != NULL;
+	}
+	
+protected:
+	
+	typedef pair<TypeID, TypeID> Key;
+	typedef map<Key, Function> Map;
+	
+	template <typename From, typename To>
+	static void convert(const MessageRef& from, MessageRef& to)
+	{
+		Message<To>::assign(to, static_cast<To>(from->as<From>()->get()));
+	}
+	
+	static Map& getFunctions()
+	{
+		static Map *functions = NULL;
+		
+		if (functions == NULL)
+		{
+			functions = new Map;
+			
+			add<int, float>();
+			add<int, double>();
+			add<float, int>();
+			add<float, double>();
+			add<double, int>();
+			add<double, float>();
+			add<bool, int>();
+			add<bool, float>();
+			add<int, bool>();
+			add<ofVec2f, ofVec3f>();
+			add<ofVec3f, ofVec2f>();
+		}
+		
+		return *functions;
+	}
+};
+
 #pragma mark - PortIdentifer
 
 struct ofxInteractivePrimitives::PortIdentifer
@@ -165,13 +378,18 @@ struct ofxInteractivePrimitives::PortIdentifer
 
 #pragma mark - PatchCord
 
-class ofxInteractivePrimitives::PatchCord : public Node, public DelayedDeletable
+class ofxInteractivePrimitives::PatchCord : public Node, public DelayedDeletable, public Pooled<PatchCord>
 {
 	friend class Port;
 	
-public:
+	template <typename T, typename P, typename V>
+	friend class Patcher;
 	
+	// only Patcher::createPatchCord connects ports, after the type and cycle checks
 	PatchCord(Port *upstream_port, Port *downstream_port);
+	
+public:
+	
 	~PatchCord() {}
 
 	void disconnect();
@@ -181,15 +399,24 @@ public:
 	Port* getUpstream() const { return upstream; }
 	Port* getDownstream() const { return downstream; }
 	
+	// between ports of different types, NULL for a direct connection
+	void setConversion(TypeConversion::Function f) { conversion = f; }
+	TypeConversion::Function getConversion() const { return conversion; }
+	
 	void draw();
+	bool drawBatched(Batch &batch);
 	void hittest();
 	
+	bool getLocalBounds(ofRectangle& r);
+	
 	void keyPressed(int key);
 	
 protected:
 	
 	Port* upstream;
 	Port* downstream;
+	
+	TypeConversion::Function conversion;
 };
 
 #pragma mark - Port
@@ -201,24 +428,23 @@ class ofxInteractivePrimitives::Port
 	
 public:
 	
+	typedef std::set<PatchCord*> CordContainerType;
+	
 	Port(BasePatcher *patcher, int index, PortIdentifer::Direction direction);
 	~Port()
 	{
 		cords.clear();
 	}
 	
-	void execute(MessageRef message);
+	// an input copies the value into the slot of its patcher, an output
+	// passes it on to every connected input
+	void execute(const MessageRef& message);
 	
 	void draw()
 	{
 		ofRect(rect);
 	}
 	
-	void hittest()
-	{
-		ofRect(rect);
-	}
-	
 	void addCord(PatchCord *cord)
 	{
 		cords.insert(cord);
@@ -251,37 +477,71 @@ public:
 	ofVec3f getGlobalPos() const;
 	
 	BasePatcher* getPatcher() const { return patcher; }
+	int getIndex() const { return index; }
+	
+	// declared by the wrapper of the patcher
+	TypeID getType() const;
 	
 	bool hasConnectTo(Port *port);
 	
+	const CordContainerType& getCords() const { return cords; }
+	
 protected:
 	
-	typedef std::set<PatchCord*> CordContainerType;
 	CordContainerType cords;
 	
 	int index;
 	BasePatcher *patcher;
 	PortIdentifer::Direction direction;
 	
-	// data
-	MessageRef data;
-	
 	ofRectangle rect;
+	
+	void receive(const MessageRef& message, TypeConversion::Function conversion);
 };
 
 class ofxInteractivePrimitives::BasePatcher : public ofxInteractivePrimitives::DelayedDeletable
 {
 	friend class Port;
+	friend class TopologicalOrder;
+	friend class Scheduler;
 	
 public:
 	
-	virtual void execute() {}
+	BasePatcher();
+	virtual ~BasePatcher();
+	
+	// compute, then publish the outputs downstream
+	virtual void execute() { compute(); publish(); }
+	
+	// reads the inputs and runs the wrapper. may run on a worker thread when
+	// isThreadSafe(), the graph stays untouched
+	virtual void compute() {}
+	
+	// sends the outputs through the cords, always on the ticking thread
+	virtual void publish() {}
+	
+	virtual bool isThreadSafe() const { return false; }
+	
+	// with a scheduler, updated inputs mark the patcher dirty and it runs
+	// on the next Scheduler::tick() instead of right away
+	void setScheduler(Scheduler *scheduler);
+	Scheduler* getScheduler() const { return scheduler; }
+	
+	// patchers connected to the outputs or inputs, once per cord
+	void getDownstream(vector<BasePatcher*>& out);
+	void getUpstream(vector<BasePatcher*>& out);
+	
+	// position in TopologicalOrder, upstream patchers have smaller indices
+	int getTopologicalIndex() const { return topological_index; }
 	
 	virtual Element2D* getUIElement() = 0;
 	
 	virtual int getNumInput() const { return 0; }
 	virtual int getNumOutput() const { return 0; }
 	
+	virtual TypeID getInputType(int index) const { return Type2Int<void>(); }
+	virtual TypeID getOutputType(int index) const { return Type2Int<void>(); }
+	
 	virtual Port& getInputPort(int index) = 0;
 	virtual Port& getOutputPort(int index) = 0;
 	
@@ -294,6 +554,179 @@ public:
 protected:
 	
 	virtual void inputDataUpdated(int index) = 0;
+	
+	// where an input port writes the values it receives, NULL once disposed
+	virtual MessageRef* getInputSlot(int index) = 0;
+	
+private:
+	
+	Scheduler *scheduler;
+	
+	// dirty and waiting for a tick
+	bool scheduled;
+	
+	int topological_index;
+	
+	// search mark of TopologicalOrder::connect
+	unsigned int visit_epoch;
+	
+	// parallel tick scratch, upstream patchers not finished yet
+	unsigned int tick_epoch;
+	int num_pending_upstream;
+};
+
+#pragma mark - TopologicalOrder
+
+// order of every patcher such that cords only run from smaller to larger
+// indices, kept up to date as cords are added (Pearce & Kelly, 2006).
+// a new cord that agrees with the order costs nothing, otherwise only the
+// patchers between its two ends are searched and renumbered.
+
+class ofxInteractivePrimitives::TopologicalOrder
+{
+public:
+	
+	static TopologicalOrder& get()
+	{
+		static TopologicalOrder *order = new TopologicalOrder;
+		return *order;
+	}
+	
+	// false when a cord from upstream to downstream would close a cycle.
+	// call before the cord is created
+	bool connect(BasePatcher *upstream, BasePatcher *downstream);
+	
+	// every live patcher, upstream first
+	void getOrder(vector<BasePatcher*>& out) const;
+	
+	size_t size() const { return slots.size() - num_holes; }
+	
+protected:
+	
+	friend class BasePatcher;
+	
+	// indexed by topological_index, NULL where a patcher was removed
+	vector<BasePatcher*> slots;
+	size_t num_holes;
+	
+	unsigned int epoch;
+	
+	// search storage, kept between calls
+	vector<BasePatcher*> forward, backward, stack, adjacent;
+	vector<int> indices;
+	
+	TopologicalOrder() : num_holes(0), epoch(0) {}
+	
+	void add(BasePatcher *patcher);
+	void remove(BasePatcher *patcher);
+	void compact();
+	
+	bool searchForward(BasePatcher *from, BasePatcher *target);
+	void searchBackward(BasePatcher *from, int lower_bound);
+	void reorder();
+	
+	static bool compareIndex(const BasePatcher *a, const BasePatcher *b)
+	{
+		return a->topological_index < b->topological_index;
+	}
+};
+
+#pragma mark - Scheduler
+
+// glitch free evaluation: patchers marked dirty run once per tick in
+// TopologicalOrder, so a patcher where two paths meet runs once and sees
+// all of its new inputs. a patcher dirtied while the tick has already
+// passed it runs on the next tick.
+// with setNumThreads(), thread safe patchers compute on a ThreadPool as soon
+// as everything upstream of them is published, the rest computes on the
+// ticking thread. publish() always runs on the ticking thread, so patchers
+// the outputs reach outside the scheduler never run on a worker. tick()
+// returns once every output is published.
+
+class ofxInteractivePrimitives::Scheduler
+{
+public:
+	
+	Scheduler() : num_executed(0), running(false), current_index(-1), pool(NULL), epoch(0), num_remaining(0), num_jobs(0) {}
+	~Scheduler();
+	
+	// 0 runs every patcher on the ticking thread
+	void setNumThreads(int num_threads);
+	int getNumThreads() const { return pool ? pool->getNumThreads() : 0; }
+	
+	void markDirty(BasePatcher *patcher);
+	bool isDirty(const BasePatcher *patcher) const { return patcher->scheduled; }
+	
+	// run every dirty patcher and what its outputs reach, in topological order
+	void tick();
+	
+	// patchers run by the last tick
+	int getNumExecuted() const { return num_executed; }
+	
+	// dirty patchers waiting for the next tick
+	size_t getNumDirty() const { return dirty.size(); }
+	
+protected:
+	
+	friend class BasePatcher;
+	
+	set<BasePatcher*> patchers;
+	
+	// a heap on the topological index while a tick runs
+	vector<BasePatcher*> dirty;
+	
+	// dirtied behind the running tick
+	vector<BasePatcher*> deferred;
+	
+	int num_executed;
+	
+	bool running;
+	int current_index;
+	
+	void attach(BasePatcher *patcher);
+	void detach(BasePatcher *patcher);
+	
+	void tickSequential();
+	
+	// parallel tick
+	
+	struct Job : public ThreadPool::Task
+	{
+		Scheduler *scheduler;
+		BasePatcher *patcher;
+		
+		void run(int worker);
+	};
+	
+	ThreadPool *pool;
+	
+	// guards computed, set when a worker adds to it
+	ofMutex mutex;
+	Poco::Event progress;
+	
+	unsigned int epoch;
+	int num_remaining;
+	
+	vector<BasePatcher*> reached, downstream, roots, main_thread, finished;
+	
+	// computed by the workers, and computed patchers waiting to publish
+	// as a heap on the topological index
+	vector<BasePatcher*> computed, ready;
+	
+	vector<Job> jobs;
+	size_t num_jobs;
+	
+	void tickParallel();
+	
+	// on the ticking thread only
+	void dispatch(BasePatcher *patcher);
+	void finish(BasePatcher *patcher);
+	
+	// min heap order
+	static bool compareIndex(const BasePatcher *a, const BasePatcher *b)
+	{
+		return a->topological_index > b->topological_index;
+	}
 };
 
 
@@ -301,7 +734,7 @@ protected:
 #pragma mark - Patcher
 
 template <typename T, typename P = ofxInteractivePrimitives::NullParam, typename InteractivePrimitiveType = ofxInteractivePrimitives::DraggableStringBox>
-class ofxInteractivePrimitives::Patcher : public BasePatcher, public InteractivePrimitiveType
+class ofxInteractivePrimitives::Patcher : public BasePatcher, public InteractivePrimitiveType, public Pooled<Patcher<T, P, InteractivePrimitiveType> >
 {
 public:
 	
@@ -341,16 +774,14 @@ public:
 	Port& getInputPort(int index) { return input_port.at(index); }
 	Port& getOutputPort(int index) { return output_port.at(index); }
 	
-	void execute()
+	// the input ports write into input_data directly
+	void compute()
 	{
-		for (int i = 0; i < getNumInput(); i++)
-		{
-			Port &input_port = getInputPort(i);
-			input_data[i] = input_port.data;
-		}
-		
 		T::execute(this, content, input_data, output_data);
-		
+	}
+	
+	void publish()
+	{
 		for (int i = 0; i < getNumOutput(); i++)
 		{
 			Port &output_port = getOutputPort(i);
@@ -358,6 +789,8 @@ public:
 		}
 	}
 	
+	bool isThreadSafe() const { return T::isThreadSafe(); }
+	
 	// ofxIP
 	
 	void update() { InteractivePrimitiveType::update(); T::update(this, content); }
@@ -437,6 +870,62 @@ public:
 		ofPopStyle();
 	}
 	
+	bool drawBatched(Batch &batch)
+	{
+		if (!InteractivePrimitiveType::drawBatched(batch)) return false;
+		
+		batch.resetStyle();
+		batch.setLineWidth(this->isHover() ? 2 : 1);
+		
+		if (this->isFocus())
+			batch.setColor(ofColor::fromHex(0xCCFF77), 127);
+		
+		ofRectangle r = this->getContentRect();
+		r.x -= 2;
+		r.y -= 2;
+		r.width += 4;
+		r.height += 4;
+		
+		batch.addRect(r, false);
+		
+		batch.resetStyle();
+		
+		const vector<GLuint>& names = this->getCurrentNameStack();
+		if (this->isHover() && names.size() == 2)
+		{
+			ofVec3f p;
+			
+			if (names[0] == PortIdentifer::INPUT
+				&& in_range(names[1], 0, getNumInput()))
+			{
+				p = getInputPort(names[1]).getPos();
+				p.y -= 1;
+			}
+			else if (names[0] == PortIdentifer::OUTPUT
+					 && in_range(names[1], 0, getNumOutput()))
+			{
+				p = getOutputPort(names[1]).getPos();
+			}
+			
+			ofRectangle r;
+			r.setFromCenter(p, 14, 8);
+			batch.addRect(r, true);
+		}
+		
+		for (int i = 0; i < getNumInput(); i++)
+			batch.addRect(getInputPort(i).getRect(), true);
+		
+		for (int i = 0; i < getNumOutput(); i++)
+			batch.addRect(getOutputPort(i).getRect(), true);
+		
+		if (patching_port && patching_port->getPatcher() == this)
+		{
+			batch.addLine(patching_port->getPos(), this->globalToLocalPos(ofVec2f(ofGetMouseX(), ofGetMouseY())));
+		}
+		
+		return true;
+	}
+	
 	void hittest()
 	{
 		InteractivePrimitiveType::hittest();
@@ -449,7 +938,7 @@ public:
 		for (int i = 0; i < getNumInput(); i++)
 		{
 			this->pushID(i);
-			getInputPort(i).hittest();
+			this->hitRect(getInputPort(i).getRect());
 			this->popID();
 		}
 		
@@ -461,19 +950,39 @@ public:
 		for (int i = 0; i < getNumOutput(); i++)
 		{
 			this->pushID(i);
-			getOutputPort(i).hittest();
+			this->hitRect(getOutputPort(i).getRect());
 			this->popID();
 		}
 		
 		this->popID();
 	}
 	
+	bool getLocalBounds(ofRectangle& r)
+	{
+		// focus frame and ports around the content
+		r = this->getContentRect();
+		r.x -= 2;
+		r.y -= 5;
+		r.width += 4;
+		r.height += 9;
+		
+		float ports = 14 * max(getNumInput(), getNumOutput());
+		if (r.width < ports) r.width = ports;
+		
+		return true;
+	}
+	
 	void mouseDragged(int x, int y, int button)
 	{
 		if (patching_port == 0)
 		{
 			InteractivePrimitiveType::mouseDragged(x, y, button);
 		}
+		else
+		{
+			// the cord being patched follows the mouse
+			this->markRenderDirty();
+		}
 	}
 	
 	void mousePressed(int x, int y, int button)
@@ -572,9 +1081,18 @@ protected:
 		for_each(output_port.begin(), output_port.end(), disconnect());
 	}
 	
+	MessageRef* getInputSlot(int index)
+	{
+		if (index < 0 || index >= (int)input_data.size()) return NULL;
+		return &input_data[index];
+	}
+	
 	void inputDataUpdated(int index)
 	{
-		execute();
+		if (Scheduler *s = getScheduler())
+			s->markDirty(this);
+		else
+			execute();
 	}
 	
 	void setupPatcher()
@@ -649,10 +1167,37 @@ protected:
 			goto __cancel__;
 		}
 		
-		// TODO: loop detection
-		
-		// create patchcord
-		return new PatchCord(upstream, downstream);
+		{
+			// types are checked here once, not for every message
+			const TypeID from = upstream->getType();
+			const TypeID to = downstream->getType();
+			
+			TypeConversion::Function conversion = NULL;
+			
+			if (!TypeConversion::isDirect(from, to))
+			{
+				conversion = TypeConversion::find(from, to);
+				
+				if (conversion == NULL)
+				{
+					msg = "type mismatch";
+					goto __cancel__;
+				}
+			}
+			
+			// closing a cycle, keeps the topological order otherwise
+			if (!TopologicalOrder::get().connect(upstream->getPatcher(), downstream->getPatcher()))
+			{
+				msg = "patching makes a loop";
+				goto __cancel__;
+			}
+			
+			// create patchcord
+			PatchCord *cord = new PatchCord(upstream, downstream);
+			cord->setConversion(conversion);
+			
+			return cord;
+		}
 		
 	__cancel__:
 		
@@ -680,6 +1225,10 @@ struct ofxInteractivePrimitives::BaseWrapper
 	static void layout(BasePatcher *patcher, void *context) {}
 	static void update(BasePatcher *patcher, void *context) {}
 	
+	// true when execute only touches its context, input and output, so the
+	// patcher may compute on a worker thread next to others
+	static bool isThreadSafe() { return false; }
+	
 	static int getNumInput()
 	{
 		return 0;
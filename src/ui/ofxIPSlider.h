@@ -17,15 +17,22 @@ public:
 	
 	ofEvent<float> valueUpdated;
 	
-	Slider(Node &root) : Element2D(root), label(*this), value(0), min(0), max(1), slider_width(0)
+	Slider(Node &root) : Element2D(root), label(*this), value(0), min(0), max(1), slider_width(0), label_dirty(true)
 	{
 		setContentRect(ofRectangle(0, 0, 100, 12));
 	}
 	
 	void update()
 	{
-		label.setText(ofToString(value));
-		label.setPosition(getContentWidth(), 1, 0);
+		if (label_dirty)
+		{
+			label.setText(ofToString(value));
+			label_dirty = false;
+		}
+		
+		// moving the label every frame would keep its transform dirty
+		if (label.getX() != getContentWidth() || label.getY() != 1)
+			label.setPosition(getContentWidth(), 1, 0);
 	}
 	
 	void draw()
@@ -43,19 +50,38 @@ public:
 		ofPopStyle();
 	}
 	
+	bool drawBatched(Batch &batch)
+	{
+		batch.addRect(getContentRect(), false);
+		
+		ofRectangle r = getContentRect();
+		r.width = slider_width * getContentWidth();
+		batch.addRect(r, true);
+		
+		return true;
+	}
+	
 	void hittest()
 	{
 		ofFill();
 		
 		pushID(0);
-		ofRect(getContentRect());
+		hitRect(getContentRect());
 		popID();
 	}
 	
+	// the label is a child and reports its own bounds
+	bool getLocalBounds(ofRectangle& r) { r = getContentRect(); return true; }
+	
 	void setValue(float v)
 	{
-		value = v;
-		slider_width = ofMap(v, min, max, 0, 1, true);
+		if (value != v)
+		{
+			value = v;
+			label_dirty = true;
+		}
+		
+		setSliderWidth(ofMap(v, min, max, 0, 1, true));
 	}
 	
 	float getValue() const { return value; }
@@ -95,17 +121,30 @@ protected:
 	float min, max;
 	float slider_width;
 	
+	// the label is formatted in update, only after value changed
+	bool label_dirty;
+	
 	StringBox label;
 	
 	void updateValue(int x)
 	{
-		slider_width = ofMap(x, 0, getContentWidth(), 0, 1, true);
+		setSliderWidth(ofMap(x, 0, getContentWidth(), 0, 1, true));
 		float v = ofMap(slider_width, 0, 1, min, max);
 		
 		if (value != v)
 		{
 			value = v;
+			label_dirty = true;
+			
 			ofNotifyEvent(valueUpdated, value);
 		}
 	}
+	
+	void setSliderWidth(float v)
+	{
+		if (slider_width == v) return;
+		
+		slider_width = v;
+		markRenderDirty();
+	}
 };
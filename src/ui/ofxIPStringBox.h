@@ -24,7 +24,7 @@ public:
 		BITMAP_CHAR_NEWLINE_HEIGHT = 5
 	};
 
-	StringBox(Node &parent) : Element2D(parent) {}
+	StringBox(Node &parent) : Element2D(parent) { layoutText(); }
 
 	void draw()
 	{
@@ -37,20 +37,67 @@ public:
 		
 		ofPopStyle();
 	}
+	
+	bool drawBatched(Batch &batch)
+	{
+		batch.addRect(getContentRect(), false);
+		drawText(batch);
+		
+		return true;
+	}
 
 	void hittest()
 	{
 		ofFill();
-		ofRect(getContentRect());
+		hitRect(getContentRect());
 	}
+	
+	// the text stays inside the box. subclasses that draw or hit test
+	// outside of it report their own bounds or none
+	bool getLocalBounds(ofRectangle& r) { r = getContentRect(); return true; }
 
 	void setText(const string& s)
 	{
+		if (text == s) return;
+		
 		text = s;
+		markRenderDirty();
+		
+		layoutText();
+	}
 
+	const string& getText() const { return text; }
+	
+protected:
+
+	typedef Batch::Glyph Glyph;
+
+	string text;
+	
+	// positions of the visible characters from the anchor of the text for
+	// batched drawing, rebuilt by setText. draw() uses ofDrawBitmapString
+	vector<Glyph> glyphs;
+	
+	// batched quads of the glyphs, kept while the text and transform do not change
+	Batch::GlyphCache glyph_cache;
+	
+	void drawText(Batch &batch)
+	{
+		batch.addGlyphs(glyphs, MARGIN, BITMAP_CHAR_HEIGHT + MARGIN, glyph_cache);
+	}
+	
+	void layoutText()
+	{
+		glyphs.clear();
+		glyph_cache.invalidate();
+		
 		int w = 0;
 		int h = 1;
 		int max_w = 0;
+		
+		// same metrics as ofDrawBitmapString, from the anchor drawText passes
+		int x = 0;
+		int y = 0;
 
 		for (int i = 0; i < text.size(); i++)
 		{
@@ -61,10 +108,20 @@ public:
 
 				w = 0;
 				h++;
+				
+				x = 0;
+				y += Batch::BITMAP_LINE_HEIGHT;
 			}
 			else
 			{
+				if (c != ' ')
+				{
+					Glyph g = { c, x, y };
+					glyphs.push_back(g);
+				}
+				
 				w++;
+				x += BITMAP_CHAR_WIDTH;
 			}
 		}
 
@@ -81,12 +138,6 @@ public:
 		setContentRect(rect);
 	}
 
-	const string& getText() const { return text; }
-	
-protected:
-
-	string text;
-
 };
 
 